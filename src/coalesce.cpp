@@ -0,0 +1,66 @@
+#include "coalesce.h"
+
+#include <utility>
+
+Coalescer::Coalescer(bool merge_runs, bool suppress_unchanged, Sink sink)
+    : merge_runs(merge_runs), suppress_unchanged(suppress_unchanged), sink(std::move(sink)) {
+}
+
+const Coalescer::Totals &Coalescer::totals(uint32_t watch) {
+    if (per_watch.size() <= watch)
+        per_watch.resize(watch + 1);
+    return per_watch[watch];
+}
+
+void Coalescer::push(const Event &e) {
+    if (per_watch.size() <= e.watch)
+        per_watch.resize(e.watch + 1);
+    Totals &t = per_watch[e.watch];
+    if (e.kind == Event::Move) {
+        ++t.moves;
+        flush();
+        sink(EventRun{e, 1, e.time_ns});
+        return;
+    }
+    ++total_events;
+
+    if (e.kind == Event::Read) {
+        ++t.reads;
+    } else {
+        ++t.writes;
+        if (suppress_unchanged && e.old_value == e.value) {
+            ++t.suppressed;
+            return;
+        }
+    }
+
+    if (sample_every > 1 && sample_seq++ % sample_every != 0)
+        return;
+
+    if (pending && merge_runs && run.first.kind == e.kind && run.first.watch == e.watch &&
+        run.first.value == e.value && run.first.rip == e.rip && run.first.stack_id == e.stack_id) {
+        ++run.count;
+        run.last_time_ns = e.time_ns;
+        if (run.count >= kMaxRunCount)
+            flush();
+        else
+            expire(e.time_ns);
+        return;
+    }
+
+    flush();
+    run = EventRun{e, 1, e.time_ns};
+    pending = true;
+}
+
+void Coalescer::expire(uint64_t now_ns) {
+    if (pending && now_ns - run.first.time_ns >= kMaxRunAgeNs)
+        flush();
+}
+
+void Coalescer::flush() {
+    if (!pending)
+        return;
+    pending = false;
+    sink(run);
+}
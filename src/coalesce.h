@@ -0,0 +1,62 @@
+#pragma once
+
+#include "event.h"
+
+#include <vector>
+#include <functional>
+
+// Reduces the event stream before it reaches the output: collapses consecutive identical events
+// into runs, drops writes that leave the value unchanged and samples every Nth event. Totals
+// count every event pushed, whatever happens to it afterwards. A run is emitted as soon as an
+// event that does not belong to it arrives, when it reaches kMaxRunCount events, or once it is
+// older than kMaxRunAgeNs, so output keeps streaming. Moves are never merged, suppressed or sampled
+// out.
+class Coalescer {
+public:
+    using Sink = std::function<void(const EventRun &)>;
+
+    static constexpr uint64_t kMaxRunCount = 10000;
+    static constexpr uint64_t kMaxRunAgeNs = 100000000;
+
+    struct Totals {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t suppressed = 0;
+        uint64_t moves = 0;
+    };
+
+    Coalescer(bool merge_runs, bool suppress_unchanged, Sink sink);
+
+    void push(const Event &e);
+
+    // Emits the pending run, if any.
+    void flush();
+
+    // Emits the pending run if it started at least kMaxRunAgeNs before `now_ns`. The tracer calls
+    // this while the tracee is idle, so a run is not held back until the next event.
+    void expire(uint64_t now_ns);
+
+    bool has_pending() const { return pending; }
+
+    void set_sample_every(uint64_t n) { sample_every = n ? n : 1; }
+
+    uint64_t sampling() const { return sample_every; }
+
+    const Totals &totals(uint32_t watch);
+
+    uint64_t events() const { return total_events; }
+
+private:
+    bool merge_runs;
+    bool suppress_unchanged;
+    Sink sink;
+
+    uint64_t sample_every = 1;
+    uint64_t sample_seq = 0;
+
+    bool pending = false;
+    EventRun run{};
+
+    std::vector<Totals> per_watch;
+    uint64_t total_events = 0;
+};
@@ -0,0 +1,228 @@
+#include "control.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+static void json_string(std::ostringstream &oss, const std::string &s) {
+    oss << '"';
+    for (char c: s) {
+        if (c == '"' || c == '\\')
+            oss << '\\' << c;
+        else if ((unsigned char) c < 0x20)
+            oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec;
+        else
+            oss << c;
+    }
+    oss << '"';
+}
+
+std::string format_metrics_prometheus(const Metrics &m) {
+    std::ostringstream oss;
+    oss << "# TYPE gwatch_events_total counter\n"
+            << "gwatch_events_total " << m.events << "\n"
+            << "# TYPE gwatch_events_per_second gauge\n"
+            << "gwatch_events_per_second " << m.events_per_second << "\n"
+            << "# TYPE gwatch_reads_total counter\n";
+    for (auto &w: m.watches)
+        oss << "gwatch_reads_total{var=\"" << w.name << "\"} " << w.reads << "\n";
+    oss << "# TYPE gwatch_writes_total counter\n";
+    for (auto &w: m.watches)
+        oss << "gwatch_writes_total{var=\"" << w.name << "\"} " << w.writes << "\n";
+    oss << "# TYPE gwatch_target_moves_total counter\n";
+    for (auto &w: m.watches)
+        oss << "gwatch_target_moves_total{var=\"" << w.name << "\"} " << w.moves << "\n";
+    oss << "# TYPE gwatch_watch_active gauge\n";
+    for (auto &w: m.watches)
+        oss << "gwatch_watch_active{var=\"" << w.name << "\"} " << (w.active ? 1 : 0) << "\n";
+    oss << "# TYPE gwatch_stop_latency_seconds summary\n"
+            << "gwatch_stop_latency_seconds_sum " << m.stop_ns_total / 1e9 << "\n"
+            << "gwatch_stop_latency_seconds_count " << m.stops << "\n"
+            << "# TYPE gwatch_stop_latency_max_seconds gauge\n"
+            << "gwatch_stop_latency_max_seconds " << m.stop_ns_max / 1e9 << "\n"
+            << "# TYPE gwatch_dropped_events_total counter\n"
+            << "gwatch_dropped_events_total " << m.dropped << "\n"
+            << "# TYPE gwatch_sample_every gauge\n"
+            << "gwatch_sample_every " << m.sample_every << "\n"
+            << "# TYPE gwatch_paused gauge\n"
+            << "gwatch_paused " << (m.paused ? 1 : 0) << "\n";
+    return oss.str();
+}
+
+std::string format_metrics_json(const Metrics &m) {
+    std::ostringstream oss;
+    oss << "{\"events\":" << m.events
+            << ",\"events_per_second\":" << m.events_per_second
+            << ",\"watches\":[";
+    for (size_t i = 0; i < m.watches.size(); ++i) {
+        const auto &w = m.watches[i];
+        oss << (i ? "," : "") << "{\"var\":";
+        json_string(oss, w.name);
+        oss << ",\"reads\":" << w.reads << ",\"writes\":" << w.writes << ",\"moves\":" << w.moves
+                << ",\"active\":" << (w.active ? "true" : "false") << "}";
+    }
+    oss << "],\"stops\":" << m.stops
+            << ",\"stop_latency_avg_us\":" << (m.stops ? m.stop_ns_total / m.stops / 1000.0 : 0.0)
+            << ",\"stop_latency_max_us\":" << m.stop_ns_max / 1000.0
+            << ",\"dropped\":" << m.dropped
+            << ",\"sample_every\":" << m.sample_every
+            << ",\"paused\":" << (m.paused ? "true" : "false") << "}\n";
+    return oss.str();
+}
+
+ControlServer::ControlServer(int epoll_fd, CommandHandler handler) : epoll_fd(epoll_fd), handler(std::move(handler)) {
+}
+
+ControlServer::~ControlServer() {
+    for (auto &c: clients)
+        close(c.first);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+}
+
+bool ControlServer::listen(const std::string &socket_path, std::string &error) {
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        error = "socket path too long";
+        return false;
+    }
+    memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        error = std::string("socket failed: ") + strerror(errno);
+        return false;
+    }
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(listen_fd, 8) < 0) {
+        error = std::string("bind failed: ") + strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    path = socket_path;
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        error = std::string("epoll_ctl failed: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void ControlServer::accept_clients() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        clients.emplace(fd, Client{});
+    }
+}
+
+void ControlServer::drop_client(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients.erase(fd);
+}
+
+void ControlServer::flush_client(int fd, Client &c) {
+    while (!c.out.empty()) {
+        ssize_t w = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                drop_client(fd);
+                return;
+            }
+            break;
+        }
+        c.out.erase(0, w);
+    }
+
+    if (c.out.empty() && c.eof) {
+        drop_client(fd);
+        return;
+    }
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | (c.out.empty() ? 0u : (uint32_t) EPOLLOUT);
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void ControlServer::service(int fd, uint32_t events) {
+    if (fd == listen_fd) {
+        accept_clients();
+        return;
+    }
+
+    auto it = clients.find(fd);
+    if (it == clients.end())
+        return;
+    Client &c = it->second;
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        char buf[1024];
+        while (true) {
+            ssize_t r = recv(fd, buf, sizeof(buf), 0);
+            if (r > 0) {
+                c.in.append(buf, r);
+                run_commands(c);
+                if (c.in.size() > kMaxLineLength) {
+                    std::string reply = "error: command longer than " + std::to_string(kMaxLineLength) + " bytes\n";
+                    send(fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+                    drop_client(fd);
+                    return;
+                }
+                continue;
+            }
+            if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                c.eof = true;
+            if (r < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+
+        // A last command without a trailing newline still counts once the client hangs up.
+        if (c.eof && !c.in.empty() && c.in.back() != '\n') {
+            c.in += '\n';
+            run_commands(c);
+        }
+    }
+
+    flush_client(fd, c);
+}
+
+// Runs every complete line received so far, leaving a partial last line in `c.in`.
+void ControlServer::run_commands(Client &c) {
+    size_t nl;
+    while ((nl = c.in.find('\n')) != std::string::npos) {
+        std::istringstream line(c.in.substr(0, nl));
+        c.in.erase(0, nl + 1);
+        std::vector<std::string> args;
+        std::string word;
+        while (line >> word)
+            args.push_back(word);
+        if (!args.empty())
+            c.out += handler(args);
+    }
+}
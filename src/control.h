@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+// Point-in-time view of the tracer's counters, filled in by the tracer loop on request.
+struct Metrics {
+    struct WatchCounters {
+        std::string name;
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        // Target changes of a pointer-chasing watch.
+        uint64_t moves = 0;
+        bool active = false;
+    };
+
+    std::vector<WatchCounters> watches;
+    uint64_t events = 0;
+    double events_per_second = 0;
+    uint64_t stops = 0;
+    uint64_t stop_ns_total = 0;
+    uint64_t stop_ns_max = 0;
+    uint64_t dropped = 0;
+    uint64_t sample_every = 1;
+    bool paused = false;
+};
+
+std::string format_metrics_prometheus(const Metrics &m);
+
+std::string format_metrics_json(const Metrics &m);
+
+// Line-oriented UNIX-domain control socket. Every line received is split into words and passed to
+// the command handler; its return value is sent back. The server never blocks: it is driven by
+// the caller's epoll loop, on the same thread as the rest of the tracer.
+class ControlServer {
+public:
+    using CommandHandler = std::function<std::string(const std::vector<std::string> &args)>;
+
+    ControlServer(int epoll_fd, CommandHandler handler);
+
+    ~ControlServer();
+
+    ControlServer(const ControlServer &) = delete;
+
+    ControlServer &operator=(const ControlServer &) = delete;
+
+    bool listen(const std::string &path, std::string &error);
+
+    void service(int fd, uint32_t events);
+
+private:
+    // Longest command line accepted; a client that sends more without a newline is dropped.
+    static constexpr size_t kMaxLineLength = 4096;
+
+    struct Client {
+        std::string in;
+        std::string out;
+        bool eof = false;
+    };
+
+    void accept_clients();
+
+    void drop_client(int fd);
+
+    void flush_client(int fd, Client &c);
+
+    void run_commands(Client &c);
+
+    int epoll_fd;
+    CommandHandler handler;
+    int listen_fd = -1;
+    std::string path;
+    std::unordered_map<int, Client> clients;
+};
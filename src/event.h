@@ -0,0 +1,26 @@
+#pragma once
+
+#include "value.h"
+
+#include <cstdint>
+
+// One access to a watched variable, as observed at a debug trap. For a Move, the target of a
+// pointer-chasing watch changed: `old_value` and `value` hold the old and new target addresses.
+struct Event {
+    enum Kind : uint8_t { Read, Write, Move };
+
+    Kind kind;
+    uint32_t watch;
+    Value old_value;
+    Value value;
+    uint64_t rip;
+    uint64_t time_ns;
+    int64_t stack_id;
+};
+
+// `count` consecutive events identical to `first`, the last of which happened at `last_time_ns`.
+struct EventRun {
+    Event first;
+    uint64_t count;
+    uint64_t last_time_ns;
+};
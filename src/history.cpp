@@ -0,0 +1,134 @@
+#include "history.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+namespace history {
+    static uint64_t clock_ns(clockid_t clock) {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    Writer::~Writer() {
+        close();
+    }
+
+    bool Writer::open(const std::string &path, std::string &error) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        if (ftruncate(fd, kPage) < 0) {
+            error = strerror(errno);
+            return false;
+        }
+
+        void *m = mmap(nullptr, kPage, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) {
+            error = strerror(errno);
+            return false;
+        }
+        header = static_cast<FileHeader *>(m);
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, kMagic, sizeof(kMagic));
+        header->version = kVersion;
+        header->block_records = kBlockRecords;
+
+        uint64_t wall = clock_ns(CLOCK_REALTIME);
+        clock_offset = wall - clock_ns(CLOCK_MONOTONIC);
+        header->start_ns = wall;
+        return true;
+    }
+
+    int Writer::var_index(const std::string &name, ValueType type) {
+        if (!header)
+            return -1;
+        for (uint32_t i = 0; i < header->var_count; ++i)
+            if (strncmp(header->names[i], name.c_str(), kNameLen) == 0)
+                return header->types[i] == static_cast<uint8_t>(type) ? (int) i : -1;
+        if (header->var_count == kMaxVars)
+            return -1;
+
+        strncpy(header->names[header->var_count], name.c_str(), kNameLen - 1);
+        header->types[header->var_count] = static_cast<uint8_t>(type);
+        __atomic_store_n(&header->var_count, header->var_count + 1, __ATOMIC_RELEASE);
+        return header->var_count - 1;
+    }
+
+    bool Writer::start_block() {
+        if (block) {
+            // Checkpoint: a finished block is flushed while the next one fills up.
+            msync(block, kBlockSize, MS_ASYNC);
+            munmap(block, kBlockSize);
+            block = nullptr;
+            ++block_index;
+        }
+
+        uint64_t offset = block_offset(block_index);
+        if (ftruncate(fd, offset + kBlockSize) < 0)
+            return false;
+        void *m = mmap(nullptr, kBlockSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+        if (m == MAP_FAILED)
+            return false;
+        block = static_cast<unsigned char *>(m);
+
+        BlockHeader *bh = reinterpret_cast<BlockHeader *>(block);
+        bh->checkpoint_mask = known_mask;
+        memcpy(bh->checkpoint, values, sizeof(values));
+        __atomic_store_n(&header->block_count, block_index + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void Writer::append(Kind kind, uint32_t var, uint64_t time_ns, const Value &value, uint64_t rip) {
+        if (!header || failed || var >= kMaxVars)
+            return;
+
+        BlockHeader *bh = reinterpret_cast<BlockHeader *>(block);
+        if (!block || bh->count == kBlockRecords) {
+            if (!start_block()) {
+                failed = true;
+                return;
+            }
+            bh = reinterpret_cast<BlockHeader *>(block);
+        }
+
+        uint64_t i = bh->count;
+        uint64_t wall = time_ns + clock_offset;
+        reinterpret_cast<uint64_t *>(block + kTimeColumn)[i] = wall;
+        reinterpret_cast<uint64_t *>(block + kValueColumn)[i] = value.lo;
+        reinterpret_cast<uint64_t *>(block + kValueHiColumn)[i] = value.hi;
+        reinterpret_cast<uint64_t *>(block + kRipColumn)[i] = rip;
+        reinterpret_cast<uint16_t *>(block + kMetaColumn)[i] = kind | var << 8;
+        if (i == 0)
+            bh->first_ns = wall;
+        bh->last_ns = wall;
+        __atomic_store_n(&bh->count, i + 1, __ATOMIC_RELEASE);
+
+        values[var] = value;
+        known_mask |= 1ULL << var;
+    }
+
+    void Writer::close() {
+        if (block) {
+            msync(block, kBlockSize, MS_SYNC);
+            munmap(block, kBlockSize);
+            block = nullptr;
+        }
+        if (header) {
+            msync(header, kPage, MS_SYNC);
+            munmap(header, kPage);
+            header = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
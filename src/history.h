@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "value.h"
+
+// On-disk layout of the value history written by `gwatch --history` and read by gwatch-query.
+//
+// The file is a header page followed by fixed-size blocks. A block holds up to kBlockRecords
+// records stored column by column: timestamps, values (low and high 8 bytes), instruction
+// pointers and a kind/variable column. Each block starts with a checkpoint of every variable's
+// value just before its first record, so any block can be decoded on its own. Block headers also
+// serve as a sparse time index: they are ordered by first timestamp, so a query binary-searches
+// them and decodes one block.
+namespace history {
+    constexpr char kMagic[8] = {'G', 'W', 'H', 'I', 'S', 'T', '1', '\0'};
+    constexpr uint32_t kVersion = 2;
+    constexpr uint32_t kBlockRecords = 4096;
+    constexpr uint32_t kMaxVars = 16;
+    constexpr uint32_t kNameLen = 64;
+    constexpr size_t kPage = 4096;
+
+    enum Kind : uint8_t {
+        // Value observed without an access, when a watch is (re-)armed.
+        Init = 0,
+        Read = 1,
+        Write = 2,
+    };
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t block_records;
+        // Blocks in use; the last one may be partially filled.
+        uint64_t block_count;
+        // Wall-clock time of the start of the recording; timestamps are wall-clock nanoseconds.
+        uint64_t start_ns;
+        uint32_t var_count;
+        uint32_t reserved;
+        char names[kMaxVars][kNameLen];
+        // ValueType of every variable
+        uint8_t types[kMaxVars];
+    };
+
+    struct BlockHeader {
+        // Records in the block; published after the record's columns are written.
+        uint64_t count;
+        uint64_t first_ns;
+        uint64_t last_ns;
+        // Bit i is set when checkpoint[i] holds the value of variable i at the start of the block.
+        uint64_t checkpoint_mask;
+        Value checkpoint[kMaxVars];
+    };
+
+    static_assert(sizeof(FileHeader) <= kPage, "file header must fit in one page");
+
+    constexpr size_t kTimeColumn = sizeof(BlockHeader);
+    constexpr size_t kValueColumn = kTimeColumn + kBlockRecords * sizeof(uint64_t);
+    constexpr size_t kValueHiColumn = kValueColumn + kBlockRecords * sizeof(uint64_t);
+    constexpr size_t kRipColumn = kValueHiColumn + kBlockRecords * sizeof(uint64_t);
+    // kind in the low byte, variable index in the high byte
+    constexpr size_t kMetaColumn = kRipColumn + kBlockRecords * sizeof(uint64_t);
+    constexpr size_t kBlockSize = (kMetaColumn + kBlockRecords * sizeof(uint16_t) + kPage - 1) / kPage * kPage;
+
+    constexpr uint64_t block_offset(uint64_t block) {
+        return kPage + block * kBlockSize;
+    }
+
+    // Appends records to a history file through a shared mapping of its current block, so a record
+    // costs a few stores and no system call.
+    class Writer {
+    public:
+        Writer() = default;
+
+        ~Writer();
+
+        Writer(const Writer &) = delete;
+
+        Writer &operator=(const Writer &) = delete;
+
+        bool open(const std::string &path, std::string &error);
+
+        // Index of the variable `name` of type `type`, registering it if needed; -1 when the table
+        // is full or the name is already registered with another type.
+        int var_index(const std::string &name, ValueType type);
+
+        void append(Kind kind, uint32_t var, uint64_t time_ns, const Value &value, uint64_t rip);
+
+        void close();
+
+    private:
+        bool start_block();
+
+        int fd = -1;
+        FileHeader *header = nullptr;
+        unsigned char *block = nullptr;
+        uint64_t block_index = 0;
+        bool failed = false;
+
+        // Offset between the monotonic clock used for events and the wall clock stored on disk.
+        uint64_t clock_offset = 0;
+
+        Value values[kMaxVars] = {};
+        uint64_t known_mask = 0;
+    };
+}
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
@@ -11,6 +12,7 @@
 #include <elf.h>
 
 #include <cerrno>
+#include <cctype>
 #include <cstring>
 #include <iostream>
 #include <fstream>
@@ -21,6 +23,17 @@
 #include <cstdint>
 #include <optional>
 #include <iomanip>
+#include <ctime>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "unwind.h"
+#include "event.h"
+#include "coalesce.h"
+#include "output.h"
+#include "control.h"
+#include "history.h"
 
 static void err_exit(const std::string &e, int code = 1) {
     std::cerr << e << std::endl;
@@ -148,23 +161,98 @@ static uint64_t ptrace_peekuser(pid_t pid, unsigned reg_offset) {
 }
 
 
-static void set_hw_breakpoints(pid_t pid, uint64_t addr, int size) {
-    ptrace_pokeuser(pid, offsetof(user, u_debugreg[0]), addr);
-    ptrace_pokeuser(pid, offsetof(user, u_debugreg[1]), addr);
+using ValueReader = Value (*)(pid_t, uint64_t);
+
+struct Watch {
+    uint32_t id;
+    std::string name;
+    // Address of the value; 0 while the target of a pointer-chasing watch cannot be resolved.
+    uint64_t addr;
+    ValueType type;
+    // Picked once from the type when the watch is set up.
+    ValueReader read;
+    ValueFormatter format;
+    Value value{};
+    // DR6 bits of the registers trapping on writes only and on any access; 0 while disarmed.
+    uint8_t write_mask = 0;
+    uint8_t rw_mask = 0;
+
+    // Pointer-chasing watches such as `*g_state+16` follow pointers from `root`, adding offsets[i]
+    // after pointer i. links[i] is where pointer i currently lives; each is watched for writes
+    // through `link_mask`, so the target can be moved when one of them changes.
+    uint64_t root = 0;
+    std::vector<int64_t> offsets;
+    std::vector<uint64_t> links;
+    uint8_t link_mask = 0;
+};
 
-    int len_encoding = (size == 4) ? 3 : 2;
+static constexpr int kDebugRegisters = 4;
 
-    uint64_t dr7 = 0;
-    dr7 |= 1ULL << 0;
-    dr7 |= 1ULL << 2;
+// Every watch takes two debug registers, one trapping on writes only and one on any access, for
+// each 8-byte part of the value, plus one trapping on writes for each pointer it follows.
+static int debug_slots(const Watch &w) {
+    return (value_size(w.type) > 8 ? 4 : 2) + (int) w.offsets.size();
+}
 
-    uint64_t field0 = ((uint64_t) 1 << 16) | ((uint64_t) len_encoding << 18);
-    uint64_t field1 = ((uint64_t) 3 << 20) | ((uint64_t) len_encoding << 22);
+static int debug_slots(const std::vector<Watch> &watches) {
+    int n = 0;
+    for (auto &w: watches)
+        n += debug_slots(w);
+    return n;
+}
 
-    dr7 |= field0 | field1;
-    ptrace_pokeuser(pid, offsetof(user, u_debugreg[7]), dr7);
+// DR7 LEN field for a watched range of `size` bytes.
+static constexpr uint64_t dr7_len(size_t size) {
+    return size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 3 : 2;
+}
 
-    ptrace_pokeuser(pid, offsetof(user, u_debugreg[6]), 0);
+static unsigned debugreg_offset(int i) {
+    return offsetof(user, u_debugreg) + i * sizeof(((user *) nullptr)->u_debugreg[0]);
+}
+
+static void set_hw_breakpoints(pid_t pid, std::vector<Watch> &watches, bool enabled) {
+    // Disable everything first, so that the kernel never sees a new address with a stale length.
+    ptrace_pokeuser(pid, debugreg_offset(7), 0);
+
+    uint64_t dr7 = 0;
+    int slot = 0;
+    for (auto &w: watches) {
+        w.write_mask = w.rw_mask = w.link_mask = 0;
+        if (!enabled)
+            continue;
+
+        // Pointers are only watched for writes: they are read far more often than they change.
+        for (uint64_t link: w.links) {
+            int link_slot = slot++;
+            ptrace_pokeuser(pid, debugreg_offset(link_slot), link);
+            dr7 |= 1ULL << (2 * link_slot);
+            dr7 |= (1ULL << (16 + 4 * link_slot)) | (dr7_len(8) << (18 + 4 * link_slot));
+            w.link_mask |= 1 << link_slot;
+        }
+        if (!w.addr)
+            continue;
+
+        // A debug register covers at most 8 bytes, so 16-byte values are watched in two halves.
+        size_t size = value_size(w.type);
+        size_t part = std::min<size_t>(size, 8);
+        uint64_t len_encoding = dr7_len(part);
+        for (size_t off = 0; off < size; off += part) {
+            int write_slot = slot++;
+            int rw_slot = slot++;
+            ptrace_pokeuser(pid, debugreg_offset(write_slot), w.addr + off);
+            ptrace_pokeuser(pid, debugreg_offset(rw_slot), w.addr + off);
+
+            dr7 |= 1ULL << (2 * write_slot);
+            dr7 |= 1ULL << (2 * rw_slot);
+            dr7 |= (1ULL << (16 + 4 * write_slot)) | (len_encoding << (18 + 4 * write_slot));
+            dr7 |= (3ULL << (16 + 4 * rw_slot)) | (len_encoding << (18 + 4 * rw_slot));
+            w.write_mask |= 1 << write_slot;
+            w.rw_mask |= 1 << rw_slot;
+        }
+    }
+    ptrace_pokeuser(pid, debugreg_offset(7), dr7);
+
+    ptrace_pokeuser(pid, debugreg_offset(6), 0);
 }
 
 static uint64_t read_debug_status(pid_t pid) {
@@ -175,55 +263,688 @@ static void clear_debug_status(pid_t pid) {
     ptrace_pokeuser(pid, offsetof(user, u_debugreg[6]), 0);
 }
 
-static uint64_t read_variable(pid_t pid, uint64_t addr, int size) {
-    uint64_t val = 0;
-    uint64_t word = ptrace_peek(pid, addr & ~(sizeof(long) - 1));
-    int offset = addr & (sizeof(long) - 1);
-    memcpy(&val, reinterpret_cast<char *>(&word) + offset, std::min((size_t) size, sizeof(long) - offset));
-    if (size > (int) (sizeof(long) - offset)) {
-        uint64_t word2 = ptrace_peek(pid, (addr & ~(sizeof(long) - 1)) + sizeof(long));
-        memcpy(reinterpret_cast<char *>(&val) + (sizeof(long) - offset), &word2, size - (sizeof(long) - offset));
+// Watched values are aligned to their size (8 bytes at most), so a value of up to 8 bytes is always
+// within one word and 16 bytes are exactly two.
+template<size_t Size>
+static Value read_value(pid_t pid, uint64_t addr) {
+    if constexpr (Size == 16) {
+        return Value{ptrace_peek(pid, addr), ptrace_peek(pid, addr + 8)};
+    } else {
+        uint64_t word = ptrace_peek(pid, addr & ~7ULL) >> (addr & 7) * 8;
+        if constexpr (Size < 8)
+            word &= (1ULL << Size * 8) - 1;
+        return Value{word, 0};
+    }
+}
+
+// Reads `size` bytes of the tracee with one process_vm_readv; false if they are not all mapped.
+static bool read_remote(pid_t pid, uint64_t addr, void *buf, size_t size) {
+    struct iovec local{buf, size};
+    struct iovec remote{(void *) addr, size};
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0) == (ssize_t) size;
+}
+
+// Follows the pointers of a chained watch from its root, updating its links, target and value.
+// If a pointer or the target cannot be read, or either is not aligned to its size, the watch is
+// left unresolved with `addr` 0, and only the links read so far stay watched. A misaligned pointer
+// is not watched at all, as one debug register could not cover all of it.
+static void resolve_chain(pid_t pid, Watch &w) {
+    w.links.clear();
+    uint64_t addr = w.root;
+    for (int64_t offset: w.offsets) {
+        uint64_t ptr;
+        if (addr % 8 != 0) {
+            addr = 0;
+            break;
+        }
+        w.links.push_back(addr);
+        if (!read_remote(pid, addr, &ptr, sizeof(ptr))) {
+            addr = 0;
+            break;
+        }
+        addr = ptr + offset;
+    }
+
+    size_t size = value_size(w.type);
+    w.value = {};
+    if (addr % std::min<size_t>(size, 8) != 0 || !read_remote(pid, addr, &w.value, size)) {
+        w.value = {};
+        addr = 0;
     }
-    return val;
+    w.addr = addr;
+}
+
+static ValueReader value_reader(size_t size) {
+    switch (size) {
+        case 1: return &read_value<1>;
+        case 2: return &read_value<2>;
+        case 4: return &read_value<4>;
+        case 8: return &read_value<8>;
+        default: return &read_value<16>;
+    }
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Formats event runs as output records. A call stack is printed in full below the first line that
+// refers to it; later lines only carry its id.
+struct EventPrinter {
+    const std::vector<std::string> *names = nullptr;
+    const std::vector<ValueFormatter> *formats = nullptr;
+    StackUnwinder *unwinder = nullptr;
+    OutputQueue *out = nullptr;
+    std::vector<bool> stack_printed;
+    std::vector<uint64_t> moves;
+
+    void operator()(const EventRun &run) {
+        const Event &e = run.first;
+        OutputRecord rec;
+        rec.events = run.count;
+
+        std::ostringstream oss;
+        const std::string &varname = (*names)[e.watch];
+        ValueFormatter format = (*formats)[e.watch];
+        if (e.kind == Event::Move) {
+            if (moves.size() <= e.watch)
+                moves.resize(e.watch + 1);
+            oss << varname << "\t\t\t\tmoved\t\t\t0x" << std::hex << e.old_value.lo << " -> 0x" << e.value.lo
+                    << std::dec << "\t\t\t(move " << ++moves[e.watch] << ")";
+        } else if (e.kind == Event::Read) {
+            oss << varname << "\t\t\t\tread\t\t\t";
+            format(oss, e.value);
+        } else {
+            oss << varname << "\t\t\t\twrite\t\t\t";
+            format(oss, e.old_value);
+            oss << " -> ";
+            format(oss, e.value);
+        }
+
+        if (run.count > 1)
+            oss << "\t\t\t(x" << run.count << ", " << (run.last_time_ns - e.time_ns) / 1000 << " us)";
+
+        if (e.stack_id >= 0) {
+            oss << "\t\t\tstack " << e.stack_id;
+            if (stack_printed.size() <= (size_t) e.stack_id)
+                stack_printed.resize(e.stack_id + 1);
+            if (!stack_printed[e.stack_id]) {
+                stack_printed[e.stack_id] = true;
+                rec.defines_stack = e.stack_id;
+                const auto &frames = unwinder->frames(e.stack_id);
+                for (size_t f = 0; f < frames.size(); ++f)
+                    oss << "\nstack " << e.stack_id << "\t\t\t\t#" << f << "\t" << unwinder->describe(frames[f]);
+            }
+        }
+        oss << "\n";
+
+        rec.text = oss.str();
+        out->push(std::move(rec));
+    }
+
+    // A dropped definition has to be printed again with the next event that uses the stack.
+    void on_drop(const OutputRecord &rec) {
+        if (rec.defines_stack >= 0)
+            stack_printed[rec.defines_stack] = false;
+    }
+};
+
+
+// Dereference chain such as `*g_state+16` or `*(*g_list+8)`: the pointer followed first is at
+// the address of `symbol` plus `root_offset`, and offsets[i] is added after following pointer i.
+struct Chain {
+    std::string symbol;
+    int64_t root_offset = 0;
+    std::vector<int64_t> offsets;
+};
+
+static bool parse_chain(const char *&p, Chain &c);
+
+// term := '*' term | '(' chain ')' | symbol
+static bool parse_chain_term(const char *&p, Chain &c) {
+    if (*p == '*') {
+        ++p;
+        if (!parse_chain_term(p, c))
+            return false;
+        c.offsets.push_back(0);
+        return true;
+    }
+    if (*p == '(') {
+        ++p;
+        if (!parse_chain(p, c) || *p != ')')
+            return false;
+        ++p;
+        return true;
+    }
+
+    const char *start = p;
+    while (isalnum((unsigned char) *p) || *p == '_' || *p == '.' || *p == '$')
+        ++p;
+    if (p == start || isdigit((unsigned char) *start))
+        return false;
+    c.symbol.assign(start, p);
+    return true;
+}
+
+// chain := term (('+' | '-') number)*
+static bool parse_chain(const char *&p, Chain &c) {
+    if (!parse_chain_term(p, c))
+        return false;
+    while (*p == '+' || *p == '-') {
+        bool negative = *p++ == '-';
+        char *end = nullptr;
+        long long n = strtoll(p, &end, 0);
+        if (!isdigit((unsigned char) *p) || end == p)
+            return false;
+        p = end;
+        (c.offsets.empty() ? c.root_offset : c.offsets.back()) += negative ? -n : n;
+    }
+    return true;
+}
+
+// Looks up a `name[:type]` watch in the executable's symbol table. `name` is a symbol or a
+// dereference chain starting from one. `type` is a type name from value.h or a byte count for an
+// unsigned value; the default is unsigned of the symbol's size, or u64 for a chain. On failure
+// returns the exit code gwatch uses for the problem and describes it in `error`.
+static int lookup_watch(const std::string &execpath, const std::string &spec, Watch &w, std::string &error) {
+    size_t colon = spec.find(':');
+    std::string name = spec.substr(0, colon);
+    std::string type_name = colon == std::string::npos ? "" : spec.substr(colon + 1);
+
+    Chain chain;
+    bool chained = !name.empty() && (name[0] == '*' || name[0] == '(');
+    if (chained) {
+        const char *p = name.c_str();
+        if (!parse_chain(p, chain) || *p != '\0' || chain.offsets.empty()) {
+            error = "cannot parse '" + name + "' (expected a symbol or a chain like *g_state+16)";
+            return 1;
+        }
+    } else {
+        chain.symbol = name;
+    }
+
+    auto sym = find_symbol_in_elf(execpath, chain.symbol);
+    if (!sym) {
+        error = "symbol '" + chain.symbol + "' not found in " + execpath;
+        return 3;
+    }
+    if (!sym->is_defined) {
+        error = "symbol '" + chain.symbol + "' is undefined in " + execpath;
+        return 4;
+    }
+
+    ValueType type = ValueType::U64;
+    if (type_name.empty()) {
+        if (!chained && !unsigned_value_type(sym->size, type)) {
+            error = "unsupported symbol size " + std::to_string(sym->size) +
+                    " (must be 1, 2, 4, 8 or 16 bytes, or give a type as " + name + ":<type>)";
+            return 5;
+        }
+    } else if (!parse_value_type(type_name, type)) {
+        char *end = nullptr;
+        unsigned long bytes = strtoul(type_name.c_str(), &end, 10);
+        if (end == type_name.c_str() || *end != '\0' || !unsigned_value_type(bytes, type)) {
+            error = "unknown type '" + type_name + "' (expected u8..u128, i8..i128, f32, f64, ptr or 1, 2, 4, 8, 16)";
+            return 5;
+        }
+    }
+
+    size_t size = value_size(type);
+    w = Watch{0, name, sym->value, type, value_reader(size), value_formatter(type)};
+
+    if (chained) {
+        // The target is only known at run time; the first pointer has to lie within the symbol.
+        int64_t end = chain.root_offset + (int64_t) sizeof(uint64_t);
+        if (chain.root_offset < 0 || end > (int64_t) sym->size || (sym->value + chain.root_offset) % 8 != 0) {
+            error = "'" + chain.symbol + "' holds no aligned pointer at offset " + std::to_string(chain.root_offset);
+            return 5;
+        }
+        // Every pointer but the last is followed to another one, which has to stay aligned too.
+        for (size_t i = 0; i + 1 < chain.offsets.size(); ++i) {
+            if (chain.offsets[i] % 8 != 0) {
+                error = "'" + name + "' follows a pointer at an offset that is not a multiple of 8";
+                return 5;
+            }
+        }
+        w.addr = 0;
+        w.root = sym->value + chain.root_offset;
+        w.offsets = chain.offsets;
+        return 0;
+    }
+
+    if (size > sym->size) {
+        error = std::string("type ") + value_type_name(type) + " is " + std::to_string(size) + " bytes but '" + name +
+                "' is only " + std::to_string(sym->size);
+        return 5;
+    }
+    if (sym->value % std::min<size_t>(size, 8) != 0) {
+        error = "'" + name + "' is not aligned to its size, so no debug register can cover it";
+        return 5;
+    }
+    return 0;
+}
+
+// State of one tracing session. Everything here is touched only from the tracer loop, which also
+// services the control socket, so none of it needs locking.
+struct Tracer {
+    pid_t child;
+    std::string execpath;
+    uint64_t base;
+
+    std::vector<Watch> watches;
+    std::vector<std::string> names;
+    std::vector<ValueFormatter> formats;
+    bool paused = false;
+    bool rearm_pending = false;
+    bool stop_requested = false;
+
+    StackUnwinder *unwinder = nullptr;
+    Coalescer *coalescer = nullptr;
+    OutputQueue *output = nullptr;
+    history::Writer *history = nullptr;
+    // History variable index of every watch id, -1 when it does not fit in the file.
+    std::vector<int> history_vars;
+    bool need_regs = false;
+
+    uint64_t stops = 0;
+    uint64_t stop_ns_total = 0;
+    uint64_t stop_ns_max = 0;
+
+    uint64_t rate_events = 0;
+    uint64_t rate_time_ns = 0;
+    double events_per_second = 0;
+
+    // A variable that was watched before and removed gets its old id back, so its counters and
+    // metrics series continue instead of being split.
+    void add_watch(Watch w) {
+        w.id = std::find(names.begin(), names.end(), w.name) - names.begin();
+        if (w.offsets.empty())
+            w.addr += base;
+        else
+            w.root += base;
+        if (w.id == names.size()) {
+            names.push_back(w.name);
+            formats.push_back(w.format);
+            history_vars.push_back(-1);
+        }
+        formats[w.id] = w.format;
+        if (history)
+            history_vars[w.id] = history->var_index(w.name, w.type);
+        watches.push_back(std::move(w));
+    }
+
+    // Re-reads the watched values and reprograms the debug registers; the tracee must be stopped.
+    void arm() {
+        rearm_pending = false;
+        uint64_t t = now_ns();
+        for (auto &w: watches) {
+            if (w.offsets.empty())
+                w.value = w.read(child, w.addr);
+            else
+                resolve_chain(child, w);
+            if (history && history_vars[w.id] >= 0)
+                history->append(history::Init, history_vars[w.id], t, w.value, 0);
+        }
+        set_hw_breakpoints(child, watches, !paused);
+    }
+
+    // Debug registers can only be changed while the tracee is stopped, so changes requested while
+    // it runs are applied at its next stop, forced with a SIGSTOP that is not passed on. The stop is
+    // sent to the traced thread itself: a process-wide one could land on an untraced thread and
+    // group-stop the others for good.
+    void request_rearm() {
+        rearm_pending = true;
+        if (!stop_requested) {
+            stop_requested = true;
+            syscall(SYS_tgkill, child, child, SIGSTOP);
+        }
+    }
+
+    // Follows the chain of `w` again after one of its pointers was written. When the target moved,
+    // reports it and returns true; the caller then moves the watchpoints before the tracee resumes,
+    // so retargeting costs no extra stop.
+    bool retarget(Watch &w, uint64_t time_ns, uint64_t rip, int64_t stack_id) {
+        uint64_t old_addr = w.addr;
+        std::vector<uint64_t> old_links = w.links;
+        resolve_chain(child, w);
+        if (w.addr == old_addr && w.links == old_links)
+            return false;
+
+        if (w.addr != old_addr) {
+            if (history && history_vars[w.id] >= 0)
+                history->append(history::Init, history_vars[w.id], time_ns, w.value, rip);
+            coalescer->push(Event{Event::Move, w.id, Value{old_addr, 0}, Value{w.addr, 0}, rip, time_ns, stack_id});
+        }
+        return true;
+    }
+
+    bool handle_trap(uint64_t time_ns) {
+        uint64_t dr6 = read_debug_status(child);
+
+        bool hit = false;
+        bool moved = false;
+        struct user_regs_struct regs;
+        int64_t stack_id = -1;
+        for (auto &w: watches) {
+            bool wr = dr6 & w.write_mask;
+            bool rd = dr6 & w.rw_mask;
+            bool relink = dr6 & w.link_mask;
+            if (!(wr || rd || relink))
+                continue;
+
+            if (!hit && need_regs) {
+                if (ptrace(PTRACE_GETREGS, child, nullptr, &regs) == -1)
+                    err_exit(std::string("ptrace GETREGS failed: ") + strerror(errno), 15);
+                if (unwinder)
+                    stack_id = unwinder->capture(regs);
+            }
+            hit = true;
+
+            if (relink)
+                moved |= retarget(w, time_ns, need_regs ? regs.rip : 0, stack_id);
+            if (!(wr || rd))
+                continue;
+
+            Value cur_value = w.read(child, w.addr);
+            Event ev{wr ? Event::Write : Event::Read, w.id, w.value, cur_value, need_regs ? regs.rip : 0, time_ns,
+                     stack_id};
+            if (wr)
+                w.value = cur_value;
+            if (history && history_vars[w.id] >= 0)
+                history->append(wr ? history::Write : history::Read, history_vars[w.id], time_ns, cur_value, ev.rip);
+            coalescer->push(ev);
+        }
+
+        if (moved)
+            set_hw_breakpoints(child, watches, !paused);
+        else if (hit)
+            clear_debug_status(child);
+        return hit;
+    }
+
+    // Handles one waitpid() status; returns true once the tracee is gone.
+    bool handle_status(int status) {
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+            return true;
+        if (!WIFSTOPPED(status))
+            return false;
+
+        uint64_t t0 = now_ns();
+        int sig = WSTOPSIG(status);
+        bool hit = false;
+        if (sig == SIGTRAP) {
+            hit = handle_trap(t0);
+            sig = 0;
+        } else if (sig == SIGSTOP && stop_requested) {
+            stop_requested = false;
+            sig = 0;
+        }
+
+        if (rearm_pending)
+            arm();
+
+        if (ptrace(PTRACE_CONT, child, nullptr, (void *) (long) sig) == -1)
+            err_exit(std::string("ptrace CONT failed: ") + strerror(errno), 11);
+
+        if (hit) {
+            uint64_t dt = now_ns() - t0;
+            ++stops;
+            stop_ns_total += dt;
+            stop_ns_max = std::max(stop_ns_max, dt);
+        }
+        return false;
+    }
+
+    // Periodic work of the tracer loop: flushes a coalesced run that has been open for too long and
+    // updates the event rate.
+    void tick(uint64_t now) {
+        coalescer->expire(now);
+        if (rate_time_ns == 0) {
+            rate_time_ns = now;
+            return;
+        }
+        if (now - rate_time_ns < 1000000000ULL)
+            return;
+        uint64_t events = coalescer->events();
+        events_per_second = (events - rate_events) * 1e9 / (now - rate_time_ns);
+        rate_events = events;
+        rate_time_ns = now;
+    }
+
+    Metrics metrics() {
+        Metrics m;
+        for (uint32_t id = 0; id < names.size(); ++id) {
+            const auto &t = coalescer->totals(id);
+            bool active = !paused && std::any_of(watches.begin(), watches.end(),
+                                                 [&](const Watch &w) { return w.id == id; });
+            m.watches.push_back(Metrics::WatchCounters{names[id], t.reads, t.writes, t.moves, active});
+        }
+        m.events = coalescer->events();
+        m.events_per_second = events_per_second;
+        m.stops = stops;
+        m.stop_ns_total = stop_ns_total;
+        m.stop_ns_max = stop_ns_max;
+        m.dropped = output->dropped();
+        m.sample_every = coalescer->sampling();
+        m.paused = paused;
+        return m;
+    }
+
+    std::string command(const std::vector<std::string> &args) {
+        const std::string &cmd = args[0];
+        auto watched = std::find_if(watches.begin(), watches.end(), [&](const Watch &w) {
+            return args.size() > 1 && w.name == args[1];
+        });
+
+        if (cmd == "metrics" && args.size() <= 2) {
+            if (args.size() == 2 && args[1] == "json")
+                return format_metrics_json(metrics());
+            return format_metrics_prometheus(metrics());
+        } else if (cmd == "add" && args.size() == 2) {
+            Watch w;
+            std::string error;
+            if (lookup_watch(execpath, args[1], w, error))
+                return "error: " + error + "\n";
+            if (std::any_of(watches.begin(), watches.end(), [&](const Watch &o) { return o.name == w.name; }))
+                return "error: '" + w.name + "' is already watched\n";
+            if (debug_slots(watches) + debug_slots(w) > kDebugRegisters)
+                return "error: no free debug registers\n";
+            add_watch(w);
+            request_rearm();
+        } else if (cmd == "remove" && args.size() == 2) {
+            if (watched == watches.end())
+                return "error: '" + args[1] + "' is not watched\n";
+            watches.erase(watched);
+            request_rearm();
+        } else if (cmd == "sample" && args.size() == 2) {
+            char *end = nullptr;
+            unsigned long n = strtoul(args[1].c_str(), &end, 10);
+            if (*end != '\0' || n == 0)
+                return "error: sample expects a positive number\n";
+            coalescer->set_sample_every(n);
+        } else if ((cmd == "pause" || cmd == "resume") && args.size() == 1) {
+            paused = cmd == "pause";
+            request_rearm();
+        } else {
+            return "error: unknown command '" + cmd + "'\n";
+        }
+        return "ok\n";
+    }
+};
+
+// Tracer loop used with --control: waits on a signalfd for SIGCHLD and on the control socket in
+// one epoll set, so commands are handled between stops on the tracer's own thread.
+static int run_with_control(Tracer &tracer, const std::string &control_path) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (sfd < 0 || ep < 0)
+        err_exit(std::string("signalfd/epoll setup failed: ") + strerror(errno), 16);
+
+    struct epoll_event sev{};
+    sev.events = EPOLLIN;
+    sev.data.fd = sfd;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &sev) < 0)
+        err_exit(std::string("epoll_ctl failed: ") + strerror(errno), 16);
+
+    ControlServer control(ep, [&](const std::vector<std::string> &args) { return tracer.command(args); });
+    std::string error;
+    if (!control.listen(control_path, error)) {
+        kill(tracer.child, SIGKILL);
+        err_exit("error: control socket " + control_path + ": " + error, 16);
+    }
+
+    int status = 0;
+    bool done = false;
+    while (!done) {
+        struct epoll_event events[16];
+        int n = epoll_wait(ep, events, 16, Coalescer::kMaxRunAgeNs / 1000000);
+        if (n < 0 && errno != EINTR)
+            err_exit(std::string("epoll_wait failed: ") + strerror(errno), 17);
+
+        // The timeout also reaps, in case a SIGCHLD arrived before the signalfd existed.
+        bool reap = n == 0;
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == sfd) {
+                struct signalfd_siginfo si;
+                while (read(sfd, &si, sizeof(si)) == sizeof(si));
+                reap = true;
+            } else {
+                control.service(events[i].data.fd, events[i].events);
+            }
+        }
+
+        while (reap && !done) {
+            pid_t r = waitpid(tracer.child, &status, WNOHANG);
+            if (r == -1)
+                err_exit(std::string("waitpid failed: ") + strerror(errno), 9);
+            if (r == 0)
+                break;
+            done = tracer.handle_status(status);
+        }
+
+        tracer.tick(now_ns());
+    }
+
+    close(ep);
+    close(sfd);
+    return status;
+}
+
+// Tracer loop used without --control. It blocks in waitpid(), except while a coalesced run is
+// pending: then it waits for SIGCHLD with a timeout, so the run is flushed even if the tracee
+// goes idle. SIGCHLD is blocked, so one that arrives between the two calls stays pending.
+static int run_plain(Tracer &tracer) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    int status = 0;
+    while (true) {
+        bool pending = tracer.coalescer->has_pending();
+        pid_t r = waitpid(tracer.child, &status, pending ? WNOHANG : 0);
+        if (r == -1)
+            err_exit(std::string("waitpid failed: ") + strerror(errno), 9);
+        if (r == 0) {
+            struct timespec timeout{0, (long) Coalescer::kMaxRunAgeNs};
+            sigtimedwait(&mask, nullptr, &timeout);
+        } else if (tracer.handle_status(status)) {
+            return status;
+        }
+        tracer.tick(now_ns());
+    }
+}
+
+static void usage_exit() {
+    err_exit("Usage: gwatch --var <symbol>[:<type>] [--var <symbol>[:<type>]] [--stack <N>] [--coalesce] [--suppress-unchanged] "
+             "[--sample <N>] [--buffer <N>] [--on-full block|drop-newest|drop-oldest] [--control <socket>] "
+             "[--history <file>] --exec <path> [-- arg1 ... argN]\n", 1);
+}
+
+static unsigned long parse_count(const char *s, const char *what) {
+    char *end = nullptr;
+    unsigned long n = strtoul(s, &end, 10);
+    if (*end != '\0' || n == 0)
+        err_exit(std::string("error: ") + what + " expects a positive number\n", 1);
+    return n;
 }
 
 int main(int argc, char **argv) {
     if (argc < 5)
-        err_exit("Usage: gwatch --var <symbol> --exec <path> [-- arg1 ... argN]\n", 1);
+        usage_exit();
 
-    std::string varname;
+    std::vector<std::string> varnames;
     std::string execpath;
     std::vector<std::string> exec_args;
-
-
-    for (int i = 1; i < argc; ++i) {
+    unsigned stack_depth = 0;
+    bool coalesce = false;
+    bool suppress_unchanged = false;
+    unsigned long sample_every = 1;
+    size_t buffer_records = 4096;
+    OutputQueue::Policy on_full = OutputQueue::Block;
+    std::string control_path;
+    std::string history_path;
+
+
+    int i = 1;
+    for (; i < argc && execpath.empty(); ++i) {
         std::string arg = argv[i];
-        if (i == 1 && arg != "--var") {
-            err_exit("Usage: gwatch --var <symbol> --exec <path> [-- arg1 ... argN]\n", 1);
-        } else if (i == 2) {
-            varname = arg;
-        } else if (i == 3 && arg != "--exec") {
-            err_exit("Usage: gwatch --var <symbol> --exec <path> [-- arg1 ... argN]\n", 1);
-        } else if (i == 4) {
-            execpath = arg;
-        } else if (i > 4) {
-            exec_args.emplace_back(arg);
+        if (arg == "--coalesce") {
+            coalesce = true;
+        } else if (arg == "--suppress-unchanged") {
+            suppress_unchanged = true;
+        } else if (i + 1 >= argc) {
+            usage_exit();
+        } else if (arg == "--var") {
+            varnames.emplace_back(argv[++i]);
+        } else if (arg == "--stack") {
+            stack_depth = parse_count(argv[++i], "--stack");
+            if (stack_depth > 256)
+                err_exit("error: --stack expects a frame count between 1 and 256\n", 1);
+        } else if (arg == "--sample") {
+            sample_every = parse_count(argv[++i], "--sample");
+        } else if (arg == "--buffer") {
+            buffer_records = parse_count(argv[++i], "--buffer");
+        } else if (arg == "--on-full") {
+            if (!parse_output_policy(argv[++i], on_full))
+                err_exit("error: --on-full expects block, drop-newest or drop-oldest\n", 1);
+        } else if (arg == "--control") {
+            control_path = argv[++i];
+        } else if (arg == "--history") {
+            history_path = argv[++i];
+        } else if (arg == "--exec") {
+            execpath = argv[++i];
+        } else {
+            usage_exit();
         }
     }
+    if (i < argc && std::string(argv[i]) == "--")
+        ++i;
+    for (; i < argc; ++i)
+        exec_args.emplace_back(argv[i]);
 
 
-    if (varname.empty() || execpath.empty())
+    if (varnames.empty() || execpath.empty())
         err_exit("missing --var or --exec", 2);
 
 
-    auto sym = find_symbol_in_elf(execpath, varname);
-    if (!sym)
-        err_exit("error: symbol '" + varname + "' not found in " + execpath + "\n", 3);
-    if (!sym->is_defined)
-        err_exit("error: symbol '" + varname + "' is undefined in " + execpath + "\n", 4);
-    if (!(sym->size == 4 || sym->size == 8))
-        err_exit(
-            "error: unsupported symbol size " + std::to_string(sym->size) + " (must be 4 or 8 bytes as required)\n", 5);
+    std::vector<Watch> initial;
+    for (auto &name: varnames) {
+        Watch w;
+        std::string error;
+        if (int code = lookup_watch(execpath, name, w, error))
+            err_exit("error: " + error + "\n", code);
+        if (std::any_of(initial.begin(), initial.end(), [&](const Watch &o) { return o.name == w.name; }))
+            err_exit("error: '" + w.name + "' is watched more than once\n", 1);
+        initial.push_back(w);
+    }
+    if (debug_slots(initial) > kDebugRegisters)
+        err_exit("error: the watched variables need " + std::to_string(debug_slots(initial)) + " debug registers, only " +
+                 std::to_string(kDebugRegisters) + " are available\n", 5);
 
 
     pid_t child = fork();
@@ -258,58 +979,81 @@ int main(int argc, char **argv) {
             err_exit("error: failed to determine base address via /proc/" + std::to_string(child) + "/maps", 10);
         }
 
-        uint64_t base = *base_opt;
-        uint64_t var_addr = base + sym->value;
-        int var_size = sym->size;
-
-        uint64_t pr_value = read_variable(child, var_addr, var_size);
-        set_hw_breakpoints(child, var_addr, var_size);
-
-        if (ptrace(PTRACE_CONT, child, nullptr, nullptr) == -1)
-            err_exit(std::string("ptrace CONT failed: ") + strerror(errno), 11);
-
-
-        while (true) {
-            if (waitpid(child, &status, 0) == -1)
-                err_exit(std::string("waitpid failed: ") + strerror(errno), 9);
+        // Both tracer loops consume SIGCHLD synchronously (signalfd or sigtimedwait), so it has to
+        // be blocked before the output thread starts; otherwise it could be delivered to that
+        // thread and lost.
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+        // A closed output pipe must not kill gwatch, and the tracee with it; writes fail with EPIPE
+        // instead and the output queue stops printing. Set after fork(), as exec keeps ignored
+        // signals ignored.
+        signal(SIGPIPE, SIG_IGN);
+
+        history::Writer history;
+        if (!history_path.empty()) {
+            std::string error;
+            if (!history.open(history_path, error)) {
+                kill(child, SIGKILL);
+                err_exit("error: cannot create history file " + history_path + ": " + error, 18);
+            }
+        }
 
+        Tracer tracer{child, execpath, *base_opt};
+        tracer.history = history_path.empty() ? nullptr : &history;
+        for (auto &w: initial)
+            tracer.add_watch(w);
+        tracer.arm();
 
-            if (WIFEXITED(status) || WIFSIGNALED(status))
-                break;
+        std::optional<StackUnwinder> unwinder;
+        if (stack_depth)
+            unwinder.emplace(child, stack_depth);
 
+        EventPrinter printer{&tracer.names, &tracer.formats, unwinder ? &*unwinder : nullptr};
+        OutputQueue output(STDOUT_FILENO, buffer_records, on_full,
+                           [&](const OutputRecord &rec) { printer.on_drop(rec); });
+        printer.out = &output;
+        Coalescer coalescer(coalesce, suppress_unchanged, std::ref(printer));
+        coalescer.set_sample_every(sample_every);
 
-            if (WIFSTOPPED(status)) {
-                int sig = WSTOPSIG(status);
-                if (sig == SIGTRAP) {
-                    uint64_t dr6 = read_debug_status(child);
-                    bool b0 = dr6 & 0x1;
-                    bool b1 = dr6 & 0x2;
+        tracer.unwinder = unwinder ? &*unwinder : nullptr;
+        tracer.coalescer = &coalescer;
+        tracer.output = &output;
+        tracer.need_regs = unwinder || coalesce || tracer.history;
 
-                    if (!(b0 || b1)) {
-                        if (ptrace(PTRACE_CONT, child, nullptr, nullptr) == -1)
-                            err_exit(std::string("ptrace CONT failed: ") + strerror(errno), 11);
+        if (ptrace(PTRACE_CONT, child, nullptr, nullptr) == -1)
+            err_exit(std::string("ptrace CONT failed: ") + strerror(errno), 11);
 
-                        continue;
-                    }
 
-                    uint64_t cur_value = read_variable(child, var_addr, var_size);
-                    if (b1 && !b0) {
-                        std::cout << varname << "\t\t\t\tread\t\t\t" << std::dec << cur_value << "\n";
-                    } else {
-                        std::cout << varname << "\t\t\t\twrite\t\t\t" << std::dec << pr_value << " -> " << cur_value <<
-                                "\n";
-                        pr_value = cur_value;
-                    }
+        if (!control_path.empty()) {
+            status = run_with_control(tracer, control_path);
+        } else {
+            status = run_plain(tracer);
+        }
 
-                    clear_debug_status(child);
 
+        coalescer.flush();
+        output.close();
+        history.close();
 
-                    if (ptrace(PTRACE_CONT, child, nullptr, nullptr) == -1)
-                        err_exit(std::string("ptrace CONT failed: ") + strerror(errno), 11);
-                } else if (ptrace(PTRACE_CONT, child, nullptr, (void *) (long) sig) == -1)
-                    err_exit(std::string("ptrace CONT failed: ") + strerror(errno), 11);
+        if (coalesce || suppress_unchanged) {
+            for (uint32_t id = 0; id < tracer.names.size(); ++id) {
+                const auto &t = coalescer.totals(id);
+                output.write_direct(tracer.names[id] + "\t\t\t\ttotal\t\t\t" + std::to_string(t.reads) + " reads, " +
+                                    std::to_string(t.writes) + " writes, " + std::to_string(t.suppressed) +
+                                    " unchanged writes suppressed\n");
             }
         }
+        for (uint32_t id = 0; id < tracer.names.size(); ++id) {
+            if (uint64_t moves = coalescer.totals(id).moves)
+                output.write_direct(tracer.names[id] + "\t\t\t\tmoved\t\t\t" + std::to_string(moves) + " times\n");
+        }
+        if (output.dropped()) {
+            output.write_direct("gwatch\t\t\t\tdropped\t\t\t" + std::to_string(output.dropped()) + " events total\n");
+            std::cerr << "gwatch: dropped " << output.dropped() << " events because the output could not keep up\n";
+        }
 
 
         int exit_code = 0;
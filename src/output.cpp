@@ -0,0 +1,127 @@
+#include "output.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+static bool write_all(int fd, const std::string &text) {
+    size_t done = 0;
+    while (done < text.size()) {
+        ssize_t w = write(fd, text.data() + done, text.size() - done);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        done += w;
+    }
+    return true;
+}
+
+static std::string drop_line(uint64_t n, const char *suffix) {
+    return "gwatch\t\t\t\tdropped\t\t\t" + std::to_string(n) + " events" + suffix + "\n";
+}
+
+bool parse_output_policy(const std::string &name, OutputQueue::Policy &policy) {
+    if (name == "block")
+        policy = OutputQueue::Block;
+    else if (name == "drop-newest")
+        policy = OutputQueue::DropNewest;
+    else if (name == "drop-oldest")
+        policy = OutputQueue::DropOldest;
+    else
+        return false;
+    return true;
+}
+
+OutputQueue::OutputQueue(int fd, size_t capacity, Policy policy, DropHandler on_drop)
+    : fd(fd), capacity(capacity), policy(policy), on_drop(std::move(on_drop)) {
+    writer = std::thread(&OutputQueue::writer_loop, this);
+}
+
+OutputQueue::~OutputQueue() {
+    close();
+}
+
+void OutputQueue::push(OutputRecord rec) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queue.size() >= capacity) {
+        if (policy == Block) {
+            not_full.wait(lock, [&] { return queue.size() < capacity || broken; });
+        } else {
+            OutputRecord victim;
+            if (policy == DropOldest) {
+                victim = std::move(queue.front());
+                queue.pop_front();
+                queue.push_back(std::move(rec));
+            } else {
+                victim = std::move(rec);
+            }
+            dropped_events += victim.events;
+            lock.unlock();
+            if (on_drop)
+                on_drop(victim);
+            return;
+        }
+    }
+    if (broken)
+        return;
+    queue.push_back(std::move(rec));
+    lock.unlock();
+    not_empty.notify_one();
+}
+
+void OutputQueue::close() {
+    if (!writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    not_empty.notify_one();
+    writer.join();
+}
+
+void OutputQueue::write_direct(const std::string &text) {
+    if (!broken)
+        write_all(fd, text);
+}
+
+void OutputQueue::writer_loop() {
+    std::deque<OutputRecord> batch;
+    std::string buf;
+    while (true) {
+        uint64_t new_drops;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [&] { return !queue.empty() || closing; });
+            if (queue.empty() && dropped_events == reported_drops)
+                return;
+            batch.swap(queue);
+            new_drops = dropped_events - reported_drops;
+            reported_drops = dropped_events;
+        }
+        not_full.notify_one();
+
+        // Drops are reported in-band, in place of the records that went missing.
+        buf.clear();
+        if (new_drops)
+            buf += drop_line(new_drops, "");
+        for (auto &rec: batch)
+            buf += rec.text;
+        batch.clear();
+
+        if (!write_all(fd, buf)) {
+            // The reader went away: tracing goes on, only the output is lost.
+            write_all(STDERR_FILENO, std::string("gwatch: cannot write output: ") + strerror(errno) +
+                                     "; tracing continues without it\n");
+            std::lock_guard<std::mutex> lock(mutex);
+            broken = true;
+            queue.clear();
+            not_full.notify_one();
+            return;
+        }
+    }
+}
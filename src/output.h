@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Formatted output for one or more events.
+struct OutputRecord {
+    std::string text;
+    uint64_t events = 1;
+    // Id of the call stack whose definition is part of `text`, or -1.
+    int64_t defines_stack = -1;
+};
+
+// Bounded queue between the tracer loop and a writer thread, so a slow consumer of the output
+// cannot stall the traced process for longer than the chosen policy allows.
+class OutputQueue {
+public:
+    enum Policy { Block, DropNewest, DropOldest };
+
+    using DropHandler = std::function<void(const OutputRecord &)>;
+
+    // `on_drop` runs on the pushing thread for every record that is discarded.
+    OutputQueue(int fd, size_t capacity, Policy policy, DropHandler on_drop);
+
+    ~OutputQueue();
+
+    OutputQueue(const OutputQueue &) = delete;
+
+    OutputQueue &operator=(const OutputQueue &) = delete;
+
+    void push(OutputRecord rec);
+
+    // Writes everything still queued and stops the writer thread.
+    void close();
+
+    // Writes `text` directly; only valid after close().
+    void write_direct(const std::string &text);
+
+    uint64_t dropped() const { return dropped_events; }
+
+private:
+    void writer_loop();
+
+    int fd;
+    size_t capacity;
+    Policy policy;
+    DropHandler on_drop;
+
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<OutputRecord> queue;
+    bool closing = false;
+    bool broken = false;
+
+    uint64_t dropped_events = 0;
+    uint64_t reported_drops = 0;
+
+    std::thread writer;
+};
+
+bool parse_output_policy(const std::string &name, OutputQueue::Policy &policy);
@@ -0,0 +1,319 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <cstdint>
+
+#include "history.h"
+#include "value.h"
+
+using namespace history;
+
+static void err_exit(const std::string &e, int code = 2) {
+    std::cerr << e << std::endl;
+    exit(code);
+}
+
+struct HistoryFile {
+    const unsigned char *mem = nullptr;
+    size_t size = 0;
+    const FileHeader *header = nullptr;
+    uint64_t blocks = 0;
+
+    const BlockHeader *block(uint64_t b) const {
+        return reinterpret_cast<const BlockHeader *>(mem + block_offset(b));
+    }
+
+    uint64_t count(uint64_t b) const {
+        uint64_t n = __atomic_load_n(&block(b)->count, __ATOMIC_ACQUIRE);
+        return n < kBlockRecords ? n : kBlockRecords;
+    }
+
+    uint32_t vars() const {
+        uint32_t n = __atomic_load_n(&header->var_count, __ATOMIC_ACQUIRE);
+        return n < kMaxVars ? n : kMaxVars;
+    }
+
+    std::string name(uint32_t var) const {
+        return std::string(header->names[var], strnlen(header->names[var], kNameLen));
+    }
+
+    ValueFormatter formatter(uint32_t var) const {
+        uint8_t t = header->types[var];
+        return value_formatter(t <= static_cast<uint8_t>(ValueType::Ptr) ? static_cast<ValueType>(t) : ValueType::U64);
+    }
+};
+
+// Maps the file; pages are only read in as blocks are touched, so queries never load it whole.
+static HistoryFile open_history(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        err_exit("error: cannot open " + path + ": " + strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < kPage)
+        err_exit("error: " + path + " is not a gwatch history file");
+
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        err_exit("error: cannot map " + path + ": " + strerror(errno));
+
+    HistoryFile h;
+    h.mem = static_cast<const unsigned char *>(m);
+    h.size = st.st_size;
+    h.header = reinterpret_cast<const FileHeader *>(h.mem);
+    if (memcmp(h.header->magic, kMagic, sizeof(kMagic)) != 0 || h.header->version != kVersion ||
+        h.header->block_records != kBlockRecords)
+        err_exit("error: " + path + " is not a gwatch history file");
+
+    uint64_t mapped = (h.size - kPage) / kBlockSize;
+    uint64_t used = __atomic_load_n(&h.header->block_count, __ATOMIC_ACQUIRE);
+    h.blocks = used < mapped ? used : mapped;
+    return h;
+}
+
+struct Record {
+    uint64_t time_ns;
+    uint32_t var;
+    Kind kind;
+    bool old_known;
+    Value old_value;
+    Value value;
+    uint64_t rip;
+};
+
+// Decodes block `b` from its checkpoint, calling `f` for every record until it returns false.
+// Returns false if decoding was stopped by `f`.
+template<typename F>
+static bool decode_block(const HistoryFile &h, uint64_t b, F &&f) {
+    const BlockHeader *bh = h.block(b);
+    const unsigned char *base = reinterpret_cast<const unsigned char *>(bh);
+    const uint64_t *times = reinterpret_cast<const uint64_t *>(base + kTimeColumn);
+    const uint64_t *values = reinterpret_cast<const uint64_t *>(base + kValueColumn);
+    const uint64_t *values_hi = reinterpret_cast<const uint64_t *>(base + kValueHiColumn);
+    const uint64_t *rips = reinterpret_cast<const uint64_t *>(base + kRipColumn);
+    const uint16_t *meta = reinterpret_cast<const uint16_t *>(base + kMetaColumn);
+
+    Value cur[kMaxVars];
+    memcpy(cur, bh->checkpoint, sizeof(cur));
+    uint64_t known = bh->checkpoint_mask;
+
+    uint64_t n = h.count(b);
+    for (uint64_t i = 0; i < n; ++i) {
+        uint32_t var = meta[i] >> 8;
+        if (var >= kMaxVars)
+            continue;
+        Record r{times[i], var, (Kind) (meta[i] & 0xff), (bool) (known >> var & 1), cur[var],
+                 Value{values[i], values_hi[i]}, rips[i]};
+        cur[var] = r.value;
+        known |= 1ULL << var;
+        if (!f(r))
+            return false;
+    }
+    return true;
+}
+
+// Last non-empty block whose first record is at or before `t`, or -1.
+static int64_t find_block(const HistoryFile &h, uint64_t t) {
+    int64_t lo = 0, hi = (int64_t) h.blocks - 1, res = -1;
+    while (lo <= hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (h.count(mid) != 0 && h.block(mid)->first_ns <= t) {
+            res = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return res;
+}
+
+static std::string format_time(const HistoryFile &h, uint64_t t) {
+    std::ostringstream oss;
+    int64_t rel = (int64_t) (t - h.header->start_ns);
+    oss << (rel < 0 ? "-" : "+") << std::llabs(rel) / 1000000000 << "." << std::setw(9) << std::setfill('0')
+            << std::llabs(rel) % 1000000000;
+    return oss.str();
+}
+
+static void print_record(const HistoryFile &h, const Record &r) {
+    ValueFormatter format = h.formatter(r.var);
+    std::cout << format_time(h, r.time_ns) << "\t" << h.name(r.var) << "\t\t\t\t";
+    if (r.kind == Write) {
+        std::cout << "write\t\t\t";
+        if (r.old_known) {
+            format(std::cout, r.old_value);
+            std::cout << " -> ";
+        }
+        format(std::cout, r.value);
+    } else {
+        std::cout << (r.kind == Read ? "read" : "init") << "\t\t\t";
+        format(std::cout, r.value);
+    }
+    std::cout << "\t\t\t0x" << std::hex << r.rip << std::dec << "\n";
+}
+
+// Accepts "+S" (seconds since the start of the recording) or absolute seconds since the epoch.
+static uint64_t parse_time(const HistoryFile &h, const std::string &s) {
+    bool relative = !s.empty() && s[0] == '+';
+    char *end = nullptr;
+    long double secs = strtold(s.c_str() + relative, &end);
+    if (end == s.c_str() + relative || *end != '\0' || secs < 0)
+        err_exit("error: bad time '" + s + "'");
+    uint64_t ns = (uint64_t) (secs * 1e9L + 0.5L);
+    return relative ? h.header->start_ns + ns : ns;
+}
+
+// Values are matched in the variable's own formatting, so "-1", "2.5" or "0x7ffd..." all work.
+static std::string canonical_value(const HistoryFile &h, uint32_t var, const Value &v) {
+    std::ostringstream oss;
+    h.formatter(var)(oss, v);
+    return oss.str();
+}
+
+static int parse_var(const HistoryFile &h, int argc, char **argv, int idx, bool default_all) {
+    if (idx >= argc) {
+        if (default_all)
+            return -1;
+        if (h.vars() == 0)
+            err_exit("error: the history is empty", 1);
+        return 0;
+    }
+    for (uint32_t i = 0; i < h.vars(); ++i)
+        if (h.name(i) == argv[idx])
+            return i;
+    err_exit(std::string("error: variable '") + argv[idx] + "' is not in the history", 1);
+    return -1;
+}
+
+static int cmd_info(const HistoryFile &h) {
+    uint64_t records = 0;
+    for (uint64_t b = 0; b < h.blocks; ++b)
+        records += h.count(b);
+
+    std::cout << "start\t\t\t\t" << h.header->start_ns / 1000000000 << "." << std::setw(9) << std::setfill('0')
+            << h.header->start_ns % 1000000000 << std::setfill(' ') << "\n";
+    std::cout << "records\t\t\t\t" << records << "\n";
+    std::cout << "blocks\t\t\t\t" << h.blocks << "\n";
+    for (uint32_t i = 0; i < h.vars(); ++i)
+        std::cout << "var\t\t\t\t" << h.name(i) << "\n";
+    if (records) {
+        std::cout << "first\t\t\t\t" << format_time(h, h.block(0)->first_ns) << "\n";
+        std::cout << "last\t\t\t\t" << format_time(h, h.block(h.blocks - 1)->last_ns) << "\n";
+    }
+    return 0;
+}
+
+static int cmd_at(const HistoryFile &h, uint64_t t, uint32_t var) {
+    int64_t b = find_block(h, t);
+    if (b < 0) {
+        std::cout << h.name(var) << "\t\t\t\tunknown\n";
+        return 1;
+    }
+
+    const BlockHeader *bh = h.block(b);
+    bool known = bh->checkpoint_mask >> var & 1;
+    Value value = bh->checkpoint[var];
+    uint64_t since = 0;
+    decode_block(h, b, [&](const Record &r) {
+        if (r.time_ns > t)
+            return false;
+        if (r.var == var) {
+            known = true;
+            value = r.value;
+            since = r.time_ns;
+        }
+        return true;
+    });
+
+    if (!known) {
+        std::cout << h.name(var) << "\t\t\t\tunknown\n";
+        return 1;
+    }
+    std::cout << h.name(var) << "\t\t\t\t";
+    h.formatter(var)(std::cout, value);
+    std::cout << "\t\t\t";
+    if (since)
+        std::cout << "since " << format_time(h, since) << "\n";
+    else
+        std::cout << "since before " << format_time(h, bh->first_ns) << "\n";
+    return 0;
+}
+
+static int cmd_range(const HistoryFile &h, uint64_t from, uint64_t to, int var) {
+    int64_t b = find_block(h, from);
+    bool any = false;
+    for (uint64_t i = b < 0 ? 0 : b; i < h.blocks; ++i) {
+        bool more = decode_block(h, i, [&](const Record &r) {
+            if (r.time_ns > to)
+                return false;
+            if (r.time_ns >= from && (var < 0 || r.var == (uint32_t) var)) {
+                print_record(h, r);
+                any = true;
+            }
+            return true;
+        });
+        if (!more)
+            break;
+    }
+    return any ? 0 : 1;
+}
+
+// Walks blocks backwards; each one is decoded forwards from its checkpoint, so the old value of
+// every write is known without looking at earlier blocks.
+static int cmd_last_change(const HistoryFile &h, const std::string &from, const std::string &to, uint32_t var) {
+    for (uint64_t i = h.blocks; i-- > 0;) {
+        bool found = false;
+        Record last{};
+        decode_block(h, i, [&](const Record &r) {
+            if (r.var == var && r.kind == Write && r.old_known && canonical_value(h, var, r.value) == to &&
+                canonical_value(h, var, r.old_value) == from) {
+                last = r;
+                found = true;
+            }
+            return true;
+        });
+        if (found) {
+            print_record(h, last);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void usage_exit() {
+    err_exit("Usage: gwatch-query <history> info\n"
+             "       gwatch-query <history> at <time> [var]\n"
+             "       gwatch-query <history> range <from> <to> [var]\n"
+             "       gwatch-query <history> last-change <old> <new> [var]\n"
+             "times are seconds since the epoch, or +seconds since the start of the recording\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3)
+        usage_exit();
+
+    HistoryFile h = open_history(argv[1]);
+    std::string cmd = argv[2];
+
+    if (cmd == "info" && argc == 3)
+        return cmd_info(h);
+    if (cmd == "at" && (argc == 4 || argc == 5))
+        return cmd_at(h, parse_time(h, argv[3]), parse_var(h, argc, argv, 4, false));
+    if (cmd == "range" && (argc == 5 || argc == 6))
+        return cmd_range(h, parse_time(h, argv[3]), parse_time(h, argv[4]), parse_var(h, argc, argv, 5, true));
+    if (cmd == "last-change" && (argc == 5 || argc == 6))
+        return cmd_last_change(h, argv[3], argv[4], parse_var(h, argc, argv, 5, false));
+
+    usage_exit();
+    return 2;
+}
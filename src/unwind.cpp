@@ -0,0 +1,698 @@
+#include "unwind.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <elf.h>
+#include <cxxabi.h>
+
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+    // Bytes of stack copied per event; deeper frames than this cannot be recovered.
+    constexpr size_t kStackWindow = 64 * 1024;
+
+    constexpr unsigned kRegRbp = 6;
+    constexpr unsigned kRegRsp = 7;
+    constexpr unsigned kMaxReg = 16;
+
+    struct Cursor {
+        const unsigned char *p;
+        const unsigned char *end;
+        bool ok = true;
+
+        template<typename T>
+        T get() {
+            T v{};
+            if ((size_t) (end - p) < sizeof(T)) {
+                ok = false;
+                p = end;
+                return v;
+            }
+            memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+            return v;
+        }
+
+        uint64_t uleb() {
+            uint64_t v = 0;
+            unsigned shift = 0;
+            while (true) {
+                if (p >= end) {
+                    ok = false;
+                    return v;
+                }
+                unsigned char b = *p++;
+                if (shift < 64)
+                    v |= (uint64_t) (b & 0x7f) << shift;
+                shift += 7;
+                if (!(b & 0x80))
+                    return v;
+            }
+        }
+
+        int64_t sleb() {
+            int64_t v = 0;
+            unsigned shift = 0;
+            unsigned char b;
+            do {
+                if (p >= end) {
+                    ok = false;
+                    return v;
+                }
+                b = *p++;
+                if (shift < 64)
+                    v |= (int64_t) (b & 0x7f) << shift;
+                shift += 7;
+            } while (b & 0x80);
+            if (shift < 64 && (b & 0x40))
+                v |= -((int64_t) 1 << shift);
+            return v;
+        }
+
+        void skip(uint64_t n) {
+            if ((uint64_t) (end - p) < n) {
+                ok = false;
+                p = end;
+                return;
+            }
+            p += n;
+        }
+    };
+
+    // Decodes a DW_EH_PE_* encoded pointer; `field_vaddr` is the link-time address of the field.
+    uint64_t read_encoded(Cursor &c, uint8_t enc, uint64_t field_vaddr) {
+        if (enc == 0xff)
+            return 0;
+
+        uint64_t v = 0;
+        switch (enc & 0x0f) {
+            case 0x00: v = c.get<uint64_t>();
+                break;
+            case 0x01: v = c.uleb();
+                break;
+            case 0x02: v = c.get<uint16_t>();
+                break;
+            case 0x03: v = c.get<uint32_t>();
+                break;
+            case 0x04: v = c.get<uint64_t>();
+                break;
+            case 0x09: v = (uint64_t) c.sleb();
+                break;
+            case 0x0a: v = (uint64_t) (int64_t) c.get<int16_t>();
+                break;
+            case 0x0b: v = (uint64_t) (int64_t) c.get<int32_t>();
+                break;
+            case 0x0c: v = (uint64_t) c.get<int64_t>();
+                break;
+            default:
+                c.ok = false;
+                return 0;
+        }
+
+        switch (enc & 0x70) {
+            case 0x00:
+                break;
+            case 0x10:
+                v += field_vaddr;
+                break;
+            default:
+                c.ok = false;
+        }
+        return v;
+    }
+
+    struct RegRule {
+        enum Kind : uint8_t { Same, Undefined, Offset, Other };
+
+        Kind kind = Same;
+        int64_t offset = 0;
+    };
+
+    struct CfaState {
+        uint64_t cfa_reg = kRegRsp;
+        int64_t cfa_offset = 8;
+        bool cfa_expression = false;
+        RegRule regs[kMaxReg + 1];
+    };
+
+    // Runs a CFA program until the row covering `target` is reached. Returns false on opcodes
+    // that cannot be interpreted.
+    bool run_cfa_program(const ElfImage::Cie &cie, const unsigned char *p, const unsigned char *end,
+                         uint64_t loc, uint64_t target, CfaState &st, const CfaState &initial) {
+        Cursor c{p, end};
+        std::vector<CfaState> saved;
+
+        auto set = [&](uint64_t reg, RegRule::Kind kind, int64_t off = 0) {
+            if (reg <= kMaxReg)
+                st.regs[reg] = RegRule{kind, off};
+        };
+        auto restore = [&](uint64_t reg) {
+            if (reg <= kMaxReg)
+                st.regs[reg] = initial.regs[reg];
+        };
+        auto advance = [&](uint64_t delta) {
+            loc += delta * cie.code_align;
+            return loc <= target;
+        };
+
+        while (c.p < c.end && c.ok) {
+            uint8_t op = c.get<uint8_t>();
+            uint8_t low = op & 0x3f;
+            switch (op & 0xc0) {
+                case 0x40:
+                    if (!advance(low))
+                        return true;
+                    continue;
+                case 0x80:
+                    set(low, RegRule::Offset, (int64_t) c.uleb() * cie.data_align);
+                    continue;
+                case 0xc0:
+                    restore(low);
+                    continue;
+                default:
+                    break;
+            }
+
+            switch (op) {
+                case 0x00:
+                    break;
+                case 0x02:
+                    if (!advance(c.get<uint8_t>()))
+                        return true;
+                    break;
+                case 0x03:
+                    if (!advance(c.get<uint16_t>()))
+                        return true;
+                    break;
+                case 0x04:
+                    if (!advance(c.get<uint32_t>()))
+                        return true;
+                    break;
+                case 0x05: {
+                    uint64_t reg = c.uleb();
+                    set(reg, RegRule::Offset, (int64_t) c.uleb() * cie.data_align);
+                    break;
+                }
+                case 0x06:
+                    restore(c.uleb());
+                    break;
+                case 0x07:
+                    set(c.uleb(), RegRule::Undefined);
+                    break;
+                case 0x08:
+                    set(c.uleb(), RegRule::Same);
+                    break;
+                case 0x09: {
+                    uint64_t reg = c.uleb();
+                    c.uleb();
+                    set(reg, RegRule::Other);
+                    break;
+                }
+                case 0x0a:
+                    saved.push_back(st);
+                    break;
+                case 0x0b:
+                    if (saved.empty())
+                        return false;
+                    st = saved.back();
+                    saved.pop_back();
+                    break;
+                case 0x0c:
+                    st.cfa_reg = c.uleb();
+                    st.cfa_offset = (int64_t) c.uleb();
+                    st.cfa_expression = false;
+                    break;
+                case 0x0d:
+                    st.cfa_reg = c.uleb();
+                    st.cfa_expression = false;
+                    break;
+                case 0x0e:
+                    st.cfa_offset = (int64_t) c.uleb();
+                    break;
+                case 0x0f:
+                    c.skip(c.uleb());
+                    st.cfa_expression = true;
+                    break;
+                case 0x10:
+                case 0x16: {
+                    uint64_t reg = c.uleb();
+                    c.skip(c.uleb());
+                    set(reg, RegRule::Other);
+                    break;
+                }
+                case 0x11: {
+                    uint64_t reg = c.uleb();
+                    set(reg, RegRule::Offset, c.sleb() * cie.data_align);
+                    break;
+                }
+                case 0x12:
+                    st.cfa_reg = c.uleb();
+                    st.cfa_offset = c.sleb() * cie.data_align;
+                    st.cfa_expression = false;
+                    break;
+                case 0x13:
+                    st.cfa_offset = c.sleb() * cie.data_align;
+                    break;
+                case 0x14:
+                case 0x15: {
+                    uint64_t reg = c.uleb();
+                    if (op == 0x14)
+                        c.uleb();
+                    else
+                        c.sleb();
+                    set(reg, RegRule::Other);
+                    break;
+                }
+                case 0x2e:
+                    c.uleb();
+                    break;
+                case 0x2f: {
+                    uint64_t reg = c.uleb();
+                    set(reg, RegRule::Offset, -(int64_t) c.uleb() * cie.data_align);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return c.ok;
+    }
+
+    std::string demangle(const char *name) {
+        int status = 0;
+        char *d = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status != 0 || !d)
+            return name;
+        std::string res(d);
+        free(d);
+        return res;
+    }
+}
+
+std::shared_ptr<ElfImage> ElfImage::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return nullptr;
+    }
+
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return nullptr;
+
+    std::shared_ptr<ElfImage> img(new ElfImage());
+    img->mem = static_cast<const unsigned char *>(m);
+    img->size = st.st_size;
+
+    const Elf64_Ehdr *eh = reinterpret_cast<const Elf64_Ehdr *>(img->mem);
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64)
+        return nullptr;
+    if (eh->e_shoff == 0 || eh->e_shoff + (uint64_t) eh->e_shnum * sizeof(Elf64_Shdr) > img->size ||
+        eh->e_shstrndx >= eh->e_shnum)
+        return img;
+
+    const Elf64_Shdr *shdrs = reinterpret_cast<const Elf64_Shdr *>(img->mem + eh->e_shoff);
+    const char *shstr = reinterpret_cast<const char *>(img->mem + shdrs[eh->e_shstrndx].sh_offset);
+    for (int i = 0; i < eh->e_shnum; ++i) {
+        const Elf64_Shdr &sh = shdrs[i];
+        if (sh.sh_type == SHT_NOBITS || sh.sh_offset + sh.sh_size > img->size)
+            continue;
+        if (strcmp(shstr + sh.sh_name, ".eh_frame") == 0)
+            img->parse_eh_frame(sh.sh_addr, sh.sh_offset, sh.sh_size);
+    }
+    img->parse_symbols();
+    return img;
+}
+
+ElfImage::~ElfImage() {
+    if (mem)
+        munmap(const_cast<unsigned char *>(mem), size);
+}
+
+bool ElfImage::load_bias(uint64_t start, uint64_t offset, uint64_t &bias) const {
+    const Elf64_Ehdr *eh = reinterpret_cast<const Elf64_Ehdr *>(mem);
+    if (eh->e_phoff + (uint64_t) eh->e_phnum * sizeof(Elf64_Phdr) > size)
+        return false;
+
+    const Elf64_Phdr *phdrs = reinterpret_cast<const Elf64_Phdr *>(mem + eh->e_phoff);
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < eh->e_phnum; ++i) {
+        const Elf64_Phdr &ph = phdrs[i];
+        if (ph.p_type != PT_LOAD)
+            continue;
+        if ((ph.p_offset & ~(page - 1)) == offset) {
+            bias = start - (ph.p_vaddr & ~(page - 1));
+            return true;
+        }
+    }
+    return false;
+}
+
+void ElfImage::parse_eh_frame(uint64_t sec_addr, uint64_t sec_offset, uint64_t sec_size) {
+    const unsigned char *sec = mem + sec_offset;
+    const unsigned char *sec_end = sec + sec_size;
+    auto vaddr_of = [&](const unsigned char *p) { return sec_addr + (p - sec); };
+
+    std::unordered_map<size_t, int64_t> cie_at;
+
+    auto parse_cie = [&](const unsigned char *start) -> int64_t {
+        auto it = cie_at.find(start - sec);
+        if (it != cie_at.end())
+            return it->second;
+
+        int64_t idx = -1;
+        Cursor c{start, sec_end};
+        uint32_t len = c.get<uint32_t>();
+        if (c.ok && len != 0 && len != 0xffffffff && len <= (uint64_t) (sec_end - c.p)) {
+            c.end = c.p + len;
+            Cie cie{};
+            uint32_t id = c.get<uint32_t>();
+            uint8_t version = c.get<uint8_t>();
+            const char *aug = reinterpret_cast<const char *>(c.p);
+            size_t aug_len = strnlen(aug, c.end - c.p);
+            c.skip(aug_len + 1);
+            if (strstr(aug, "eh"))
+                c.skip(8);
+            cie.code_align = c.uleb();
+            cie.data_align = c.sleb();
+            cie.ra_reg = version == 1 ? c.get<uint8_t>() : c.uleb();
+            cie.fde_encoding = 0;
+
+            bool supported = id == 0;
+            if (aug[0] == 'z') {
+                cie.has_augmentation_data = true;
+                uint64_t data_len = c.uleb();
+                const unsigned char *data_end = c.p + data_len;
+                for (const char *a = aug + 1; *a && c.ok; ++a) {
+                    if (*a == 'R') {
+                        cie.fde_encoding = c.get<uint8_t>();
+                    } else if (*a == 'P') {
+                        uint8_t enc = c.get<uint8_t>();
+                        bool ok = c.ok;
+                        read_encoded(c, enc & 0x7f, vaddr_of(c.p));
+                        c.ok = ok;
+                    } else if (*a == 'L') {
+                        c.get<uint8_t>();
+                    } else if (*a != 'S' && *a != 'B') {
+                        break;
+                    }
+                }
+                c.p = data_end;
+            } else if (aug[0] != '\0') {
+                supported = false;
+            }
+
+            if (supported && c.ok && c.p <= c.end) {
+                cie.instr = c.p;
+                cie.instr_end = c.end;
+                idx = cies.size();
+                cies.push_back(cie);
+            }
+        }
+        cie_at.emplace(start - sec, idx);
+        return idx;
+    };
+
+    const unsigned char *p = sec;
+    while (sec_end - p >= 4) {
+        uint32_t len32;
+        memcpy(&len32, p, 4);
+        if (len32 == 0)
+            break;
+        if (len32 == 0xffffffff)
+            break;
+        const unsigned char *entry = p + 4;
+        if (len32 > (uint64_t) (sec_end - entry) || len32 < 4)
+            break;
+        const unsigned char *entry_end = entry + len32;
+
+        uint32_t id;
+        memcpy(&id, entry, 4);
+        if (id != 0 && id <= (uint64_t) (entry - sec)) {
+            int64_t cie_idx = parse_cie(entry - id);
+            if (cie_idx >= 0) {
+                const Cie &cie = cies[cie_idx];
+                Cursor c{entry + 4, entry_end};
+                uint64_t pc_begin = read_encoded(c, cie.fde_encoding, vaddr_of(c.p));
+                uint64_t pc_range = read_encoded(c, cie.fde_encoding & 0x0f, 0);
+                if (cie.has_augmentation_data)
+                    c.skip(c.uleb());
+                if (c.ok && pc_range != 0)
+                    fdes.push_back(Fde{pc_begin, pc_begin + pc_range, c.p, entry_end, (uint32_t) cie_idx});
+            }
+        }
+        p = entry_end;
+    }
+
+    std::sort(fdes.begin(), fdes.end(), [](const Fde &a, const Fde &b) { return a.pc_begin < b.pc_begin; });
+}
+
+void ElfImage::parse_symbols() {
+    const Elf64_Ehdr *eh = reinterpret_cast<const Elf64_Ehdr *>(mem);
+    const Elf64_Shdr *shdrs = reinterpret_cast<const Elf64_Shdr *>(mem + eh->e_shoff);
+
+    for (unsigned type: {SHT_SYMTAB, SHT_DYNSYM}) {
+        for (int i = 0; i < eh->e_shnum; ++i) {
+            const Elf64_Shdr &sh = shdrs[i];
+            if (sh.sh_type != type || sh.sh_entsize != sizeof(Elf64_Sym) || sh.sh_link >= eh->e_shnum ||
+                sh.sh_offset + sh.sh_size > size)
+                continue;
+            const char *strtab = reinterpret_cast<const char *>(mem + shdrs[sh.sh_link].sh_offset);
+            const Elf64_Sym *syms = reinterpret_cast<const Elf64_Sym *>(mem + sh.sh_offset);
+            size_t n = sh.sh_size / sh.sh_entsize;
+            for (size_t j = 0; j < n; ++j) {
+                const Elf64_Sym &s = syms[j];
+                if (ELF64_ST_TYPE(s.st_info) != STT_FUNC || s.st_shndx == SHN_UNDEF || s.st_value == 0)
+                    continue;
+                funcs.push_back(Func{s.st_value, s.st_size, strtab + s.st_name});
+            }
+        }
+        if (!funcs.empty())
+            break;
+    }
+
+    std::sort(funcs.begin(), funcs.end(), [](const Func &a, const Func &b) { return a.addr < b.addr; });
+}
+
+const ElfImage::Fde *ElfImage::find_fde(uint64_t vaddr) const {
+    auto it = std::upper_bound(fdes.begin(), fdes.end(), vaddr,
+                               [](uint64_t v, const Fde &f) { return v < f.pc_begin; });
+    if (it == fdes.begin())
+        return nullptr;
+    --it;
+    return vaddr < it->pc_end ? &*it : nullptr;
+}
+
+std::string ElfImage::symbolize(uint64_t vaddr) const {
+    auto it = std::upper_bound(funcs.begin(), funcs.end(), vaddr,
+                               [](uint64_t v, const Func &f) { return v < f.addr; });
+    if (it == funcs.begin())
+        return "";
+    --it;
+    if (it->size != 0 && vaddr >= it->addr + it->size)
+        return "";
+
+    std::ostringstream oss;
+    oss << demangle(it->name) << "+0x" << std::hex << (vaddr - it->addr);
+    return oss.str();
+}
+
+StackUnwinder::StackUnwinder(pid_t pid, unsigned max_depth) : pid(pid), max_depth(max_depth) {
+}
+
+size_t StackUnwinder::FramesHash::operator()(const std::vector<uint64_t> &v) const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint64_t pc: v) {
+        h ^= pc;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+void StackUnwinder::refresh_modules() {
+    std::ostringstream oss;
+    oss << "/proc/" << pid << "/maps";
+    std::ifstream f(oss.str());
+    if (!f)
+        return;
+
+    modules.clear();
+    std::string line;
+    while (getline(f, line)) {
+        std::istringstream ls(line);
+        std::string range, perms, offset, dev, inode, path;
+        ls >> range >> perms >> offset >> dev >> inode;
+        getline(ls >> std::ws, path);
+
+        size_t dash = range.find('-');
+        if (dash == std::string::npos)
+            continue;
+        uint64_t start = stoull(range.substr(0, dash), nullptr, 16);
+        uint64_t end = stoull(range.substr(dash + 1), nullptr, 16);
+
+        if (path == "[stack]") {
+            stack_start = start;
+            stack_end = end;
+            continue;
+        }
+        if (perms.size() < 3 || perms[2] != 'x' || path.empty() || path[0] != '/')
+            continue;
+
+        auto it = images.find(path);
+        if (it == images.end())
+            it = images.emplace(path, ElfImage::open(path)).first;
+
+        Module m{start, end, 0, path, it->second};
+        if (m.image && !m.image->load_bias(start, stoull(offset, nullptr, 16), m.bias))
+            m.image = nullptr;
+        modules.push_back(std::move(m));
+    }
+
+    std::sort(modules.begin(), modules.end(), [](const Module &a, const Module &b) { return a.start < b.start; });
+}
+
+const StackUnwinder::Module *StackUnwinder::find_module(uint64_t pc) {
+    auto lookup = [&]() -> const Module * {
+        auto it = std::upper_bound(modules.begin(), modules.end(), pc,
+                                   [](uint64_t v, const Module &m) { return v < m.start; });
+        if (it == modules.begin())
+            return nullptr;
+        --it;
+        return pc < it->end ? &*it : nullptr;
+    };
+
+    const Module *m = lookup();
+    if (!m) {
+        refresh_modules();
+        m = lookup();
+    }
+    return m;
+}
+
+const UnwindRule &StackUnwinder::rule_for(uint64_t pc) {
+    auto it = rules.find(pc);
+    if (it != rules.end())
+        return it->second;
+
+    UnwindRule rule;
+    const Module *m = find_module(pc);
+    const ElfImage::Fde *fde = (m && m->image) ? m->image->find_fde(pc - m->bias) : nullptr;
+    if (fde) {
+        const ElfImage::Cie &cie = m->image->cie(fde->cie);
+        CfaState initial;
+        CfaState st;
+        bool ok = run_cfa_program(cie, cie.instr, cie.instr_end, 0, UINT64_MAX, initial, initial);
+        st = initial;
+        ok = ok && run_cfa_program(cie, fde->instr, fde->instr_end, fde->pc_begin, pc - m->bias, st, initial);
+
+        const RegRule &ra = cie.ra_reg <= kMaxReg ? st.regs[cie.ra_reg] : RegRule{RegRule::Other};
+        const RegRule &rbp = st.regs[kRegRbp];
+        if (ok && ra.kind == RegRule::Undefined) {
+            rule.kind = UnwindRule::Outermost;
+        } else if (ok && !st.cfa_expression && (st.cfa_reg == kRegRsp || st.cfa_reg == kRegRbp) &&
+                   ra.kind == RegRule::Offset) {
+            rule.kind = UnwindRule::Cfa;
+            rule.cfa_from_rbp = st.cfa_reg == kRegRbp;
+            rule.cfa_offset = st.cfa_offset;
+            rule.ra_offset = ra.offset;
+            rule.rbp_saved = rbp.kind == RegRule::Offset;
+            rule.rbp_offset = rbp.offset;
+        }
+    }
+    return rules.emplace(pc, rule).first->second;
+}
+
+uint32_t StackUnwinder::capture(const user_regs_struct &regs) {
+    uint64_t base = regs.rsp;
+    uint64_t rsp = regs.rsp;
+    uint64_t rbp = regs.rbp;
+    uint64_t pc = regs.rip;
+
+    if (rsp < stack_start || rsp >= stack_end)
+        refresh_modules();
+    size_t want = kStackWindow;
+    if (rsp >= stack_start && rsp < stack_end)
+        want = std::min<uint64_t>(want, stack_end - rsp);
+
+    // One copy of the live stack; every load below is served from it.
+    snapshot.resize(want);
+    struct iovec local{snapshot.data(), want};
+    struct iovec remote{reinterpret_cast<void *>(base), want};
+    ssize_t got = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    if (got < 0)
+        got = 0;
+
+    auto load = [&](uint64_t addr, uint64_t &out) {
+        if (addr < base || addr - base + sizeof(uint64_t) > (uint64_t) got)
+            return false;
+        memcpy(&out, snapshot.data() + (addr - base), sizeof(uint64_t));
+        return true;
+    };
+
+    scratch.clear();
+    scratch.push_back(pc);
+    while (scratch.size() < max_depth) {
+        // Return addresses point past the call, which may already be outside the caller's FDE.
+        const UnwindRule &r = rule_for(scratch.size() == 1 ? pc : pc - 1);
+        if (r.kind == UnwindRule::Outermost)
+            break;
+
+        uint64_t cfa, ra, new_rbp = rbp;
+        if (r.kind == UnwindRule::Cfa) {
+            cfa = (r.cfa_from_rbp ? rbp : rsp) + r.cfa_offset;
+            if (!load(cfa + r.ra_offset, ra))
+                break;
+            if (r.rbp_saved && !load(cfa + r.rbp_offset, new_rbp))
+                break;
+        } else {
+            if (rbp < rsp || !load(rbp + 8, ra) || !load(rbp, new_rbp))
+                break;
+            cfa = rbp + 16;
+        }
+
+        if (ra == 0 || cfa <= rsp)
+            break;
+        pc = ra;
+        rsp = cfa;
+        rbp = new_rbp;
+        scratch.push_back(pc);
+    }
+
+    auto it = stack_ids.find(scratch);
+    if (it != stack_ids.end())
+        return it->second;
+
+    uint32_t id = stacks.size();
+    stacks.push_back(scratch);
+    stack_ids.emplace(scratch, id);
+    return id;
+}
+
+std::string StackUnwinder::describe(uint64_t pc) {
+    std::ostringstream oss;
+    oss << "0x" << std::hex << std::setfill('0') << std::setw(16) << pc;
+
+    const Module *m = find_module(pc);
+    if (!m)
+        return oss.str();
+
+    std::string sym = m->image ? m->image->symbolize(pc - m->bias) : "";
+    if (!sym.empty())
+        oss << "\t" << sym;
+    oss << "\t(" << m->path.substr(m->path.rfind('/') + 1) << ")";
+    return oss.str();
+}
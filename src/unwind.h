@@ -0,0 +1,131 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+// Read-only mmap of an ELF file, kept alive for as long as any module references it.
+class ElfImage {
+public:
+    static std::shared_ptr<ElfImage> open(const std::string &path);
+
+    ~ElfImage();
+
+    ElfImage(const ElfImage &) = delete;
+
+    ElfImage &operator=(const ElfImage &) = delete;
+
+    // Load bias for a mapping of this file starting at `start` with file offset `offset`.
+    bool load_bias(uint64_t start, uint64_t offset, uint64_t &bias) const;
+
+    // Nearest function symbol at or below `vaddr`, as "name+0xoff".
+    std::string symbolize(uint64_t vaddr) const;
+
+    struct Fde {
+        uint64_t pc_begin;
+        uint64_t pc_end;
+        const unsigned char *instr;
+        const unsigned char *instr_end;
+        uint32_t cie;
+    };
+
+    struct Cie {
+        uint64_t code_align;
+        int64_t data_align;
+        uint64_t ra_reg;
+        uint8_t fde_encoding;
+        bool has_augmentation_data;
+        const unsigned char *instr;
+        const unsigned char *instr_end;
+    };
+
+    const Fde *find_fde(uint64_t vaddr) const;
+
+    const Cie &cie(uint32_t idx) const { return cies[idx]; }
+
+private:
+    ElfImage() = default;
+
+    void parse_eh_frame(uint64_t sec_addr, uint64_t sec_offset, uint64_t sec_size);
+
+    void parse_symbols();
+
+    const unsigned char *mem = nullptr;
+    size_t size = 0;
+
+    std::vector<Cie> cies;
+    std::vector<Fde> fdes;
+
+    struct Func {
+        uint64_t addr;
+        uint64_t size;
+        const char *name;
+    };
+
+    std::vector<Func> funcs;
+};
+
+// Register recovery rule for one PC, as derived from CFI (or the frame pointer fallback).
+struct UnwindRule {
+    enum Kind : uint8_t { FramePointer, Cfa, Outermost };
+
+    Kind kind = FramePointer;
+    bool cfa_from_rbp = false;
+    bool rbp_saved = false;
+    int64_t cfa_offset = 0;
+    int64_t ra_offset = 0;
+    int64_t rbp_offset = 0;
+};
+
+// Captures call stacks of the traced process and interns them into a stack-id table.
+class StackUnwinder {
+public:
+    StackUnwinder(pid_t pid, unsigned max_depth);
+
+    // Unwinds from `regs` and returns the id of the resulting stack.
+    uint32_t capture(const user_regs_struct &regs);
+
+    const std::vector<uint64_t> &frames(uint32_t id) const { return stacks[id]; }
+
+    std::string describe(uint64_t pc);
+
+private:
+    struct Module {
+        uint64_t start;
+        uint64_t end;
+        uint64_t bias;
+        std::string path;
+        std::shared_ptr<ElfImage> image;
+    };
+
+    struct FramesHash {
+        size_t operator()(const std::vector<uint64_t> &v) const;
+    };
+
+    const Module *find_module(uint64_t pc);
+
+    void refresh_modules();
+
+    const UnwindRule &rule_for(uint64_t pc);
+
+    pid_t pid;
+    unsigned max_depth;
+
+    std::vector<Module> modules;
+    std::unordered_map<std::string, std::shared_ptr<ElfImage> > images;
+    uint64_t stack_start = 0;
+    uint64_t stack_end = 0;
+
+    std::unordered_map<uint64_t, UnwindRule> rules;
+
+    std::vector<std::vector<uint64_t> > stacks;
+    std::unordered_map<std::vector<uint64_t>, uint32_t, FramesHash> stack_ids;
+
+    std::vector<unsigned char> snapshot;
+    std::vector<uint64_t> scratch;
+};
@@ -0,0 +1,126 @@
+#include "value.h"
+
+#include <cstring>
+#include <charconv>
+#include <type_traits>
+
+namespace {
+    struct Pointer {
+        uint64_t addr;
+    };
+
+    void print(std::ostream &os, unsigned __int128 v) {
+        char buf[40];
+        char *p = buf + sizeof(buf);
+        do {
+            *--p = char('0' + (unsigned) (v % 10));
+            v /= 10;
+        } while (v);
+        os.write(p, buf + sizeof(buf) - p);
+    }
+
+    void print(std::ostream &os, __int128 v) {
+        if (v < 0) {
+            os << '-';
+            print(os, (unsigned __int128) 0 - (unsigned __int128) v);
+        } else {
+            print(os, (unsigned __int128) v);
+        }
+    }
+
+    void print(std::ostream &os, Pointer v) {
+        os << "0x" << std::hex << v.addr << std::dec;
+    }
+
+    template<typename T>
+    std::enable_if_t<std::is_integral_v<T> > print(std::ostream &os, T v) {
+        // Unary plus keeps 1-byte integers from printing as characters.
+        os << +v;
+    }
+
+    template<typename T>
+    std::enable_if_t<std::is_floating_point_v<T> > print(std::ostream &os, T v) {
+        char buf[64];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        os.write(buf, res.ptr - buf);
+    }
+
+    template<typename T>
+    void format(std::ostream &os, const Value &value) {
+        static_assert(sizeof(T) <= sizeof(Value), "value too wide");
+        T v;
+        memcpy(&v, &value, sizeof(T));
+        print(os, v);
+    }
+
+    struct TypeInfo {
+        ValueType type;
+        const char *name;
+        size_t size;
+        ValueFormatter format;
+    };
+
+    template<typename T>
+    constexpr TypeInfo info(ValueType type, const char *name) {
+        return TypeInfo{type, name, sizeof(T), &format<T>};
+    }
+
+    const TypeInfo kTypes[] = {
+        info<uint8_t>(ValueType::U8, "u8"),
+        info<uint16_t>(ValueType::U16, "u16"),
+        info<uint32_t>(ValueType::U32, "u32"),
+        info<uint64_t>(ValueType::U64, "u64"),
+        info<unsigned __int128>(ValueType::U128, "u128"),
+        info<int8_t>(ValueType::I8, "i8"),
+        info<int16_t>(ValueType::I16, "i16"),
+        info<int32_t>(ValueType::I32, "i32"),
+        info<int64_t>(ValueType::I64, "i64"),
+        info<__int128>(ValueType::I128, "i128"),
+        info<float>(ValueType::F32, "f32"),
+        info<double>(ValueType::F64, "f64"),
+        info<Pointer>(ValueType::Ptr, "ptr"),
+    };
+
+    const TypeInfo &lookup(ValueType type) {
+        return kTypes[static_cast<size_t>(type)];
+    }
+}
+
+bool parse_value_type(const std::string &name, ValueType &type) {
+    for (auto &t: kTypes) {
+        if (name == t.name) {
+            type = t.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool unsigned_value_type(size_t size, ValueType &type) {
+    switch (size) {
+        case 1: type = ValueType::U8;
+            return true;
+        case 2: type = ValueType::U16;
+            return true;
+        case 4: type = ValueType::U32;
+            return true;
+        case 8: type = ValueType::U64;
+            return true;
+        case 16: type = ValueType::U128;
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t value_size(ValueType type) {
+    return lookup(type).size;
+}
+
+const char *value_type_name(ValueType type) {
+    return lookup(type).name;
+}
+
+ValueFormatter value_formatter(ValueType type) {
+    return lookup(type).format;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+
+// Raw bytes of a watched value, up to 16 of them, little-endian and zero-extended.
+struct Value {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const Value &o) const { return lo == o.lo && hi == o.hi; }
+
+    bool operator!=(const Value &o) const { return !(*this == o); }
+};
+
+// How the bytes of a watched variable are interpreted. The type of a watch is fixed when it is set
+// up, and so is the formatter picked for it; nothing on the event path switches on the type.
+enum class ValueType : uint8_t { U8, U16, U32, U64, U128, I8, I16, I32, I64, I128, F32, F64, Ptr };
+
+using ValueFormatter = void (*)(std::ostream &, const Value &);
+
+bool parse_value_type(const std::string &name, ValueType &type);
+
+// Unsigned type of `size` bytes; false for sizes that cannot be watched.
+bool unsigned_value_type(size_t size, ValueType &type);
+
+size_t value_size(ValueType type);
+
+const char *value_type_name(ValueType type);
+
+ValueFormatter value_formatter(ValueType type);
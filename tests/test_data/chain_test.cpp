@@ -0,0 +1,22 @@
+#include <cstdint>
+
+struct State {
+    uint64_t id;
+    uint64_t flags;
+    volatile uint64_t counter;
+};
+
+State states[3];
+State *volatile g_state = nullptr;
+
+int main() {
+    for (int round = 0; round < 3; ++round) {
+        g_state = &states[round];
+        for (int i = 0; i < 5; ++i)
+            g_state->counter = g_state->counter + 1;
+        g_state = &states[round];
+    }
+    g_state = nullptr;
+    states[0].counter = 100;
+    return 0;
+}
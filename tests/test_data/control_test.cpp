@@ -0,0 +1,15 @@
+#include <cstdio>
+#include <unistd.h>
+#include <cstdint>
+
+volatile uint64_t watched = 0;
+volatile uint64_t other = 0;
+
+int main() {
+    for (int i = 0; i < 3000; ++i) {
+        watched = watched + 1;
+        other = i;
+        usleep(1000);
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+#include <cstdio>
+#include <unistd.h>
+#include <cstdint>
+
+volatile uint64_t watched = 0;
+
+int main() {
+    uint64_t a = 0;
+
+    watched = 7;
+    for (int i = 0; i < 100; ++i)
+        a += watched;
+    sleep(2);
+    (void)a;
+    return 0;
+}
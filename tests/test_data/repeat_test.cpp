@@ -0,0 +1,17 @@
+#include <cstdio>
+#include <unistd.h>
+#include <cstdint>
+
+volatile uint64_t watched = 0;
+
+int main() {
+    uint64_t a = 0;
+
+    watched = 7;
+    for (int i = 0; i < 100; ++i)
+        a += watched;
+    for (int i = 0; i < 50; ++i)
+        watched = 7;
+    (void)a;
+    return 0;
+}
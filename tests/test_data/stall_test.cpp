@@ -0,0 +1,15 @@
+#include <cstdio>
+#include <unistd.h>
+#include <cstdint>
+
+volatile uint64_t watched = 0;
+
+int main() {
+    uint64_t a = 0;
+
+    watched = 1;
+    for (int i = 0; i < 50000; ++i)
+        a += watched;
+    (void)a;
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include <cstdint>
+
+volatile int16_t small = 0;
+volatile float ratio = 0;
+volatile uint8_t byte_ = 200;
+int items[4];
+int *volatile cursor = nullptr;
+alignas(16) volatile unsigned __int128 wide = 0;
+
+int main() {
+    small = -5;
+    small = small - 1;
+
+    ratio = 1.5f;
+    ratio = ratio * 2;
+
+    byte_ = byte_ + 1;
+
+    cursor = &items[1];
+
+    wide = (unsigned __int128) 2 << 64 | 1;
+    return 0;
+}
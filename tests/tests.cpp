@@ -2,14 +2,18 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <array>
+#include <chrono>
 #include <memory>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 static std::string run_command_capture_stdout(const std::string &cmd) {
@@ -48,6 +52,8 @@ TEST(GWatchFunctional, BasicReadsAndWrites) { {
 
     EXPECT_EQ(res.first, 11);
     EXPECT_EQ(res.second, 20);
+
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var watched --var watched --exec /tmp/basic_test.out 2>/dev/null")), 1);
 }
 
 TEST(GWatchFunctional, Functions) { {
@@ -63,6 +69,317 @@ TEST(GWatchFunctional, Functions) { {
     EXPECT_EQ(res.second, 21);
 }
 
+TEST(GWatchFunctional, CallStacks) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/recursion_test.out test_data/recursion_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    std::string cmd = "./gwatch --var watched --stack 32 --exec /tmp/recursion_test.out";
+    std::string out = run_command_capture_stdout(cmd);
+
+    int events = 0, with_stack = 0, definitions = 0, recursive_frames = 0;
+    std::istringstream iss(out);
+    std::string line;
+    while (std::getline(iss, line)) {
+        if (line.rfind("watched\t", 0) == 0) {
+            ++events;
+            if (line.find("\tstack ") != std::string::npos)
+                ++with_stack;
+        } else if (line.rfind("stack ", 0) == 0) {
+            if (line.find("\t#0\t") != std::string::npos)
+                ++definitions;
+            if (line.find("writes(int)") != std::string::npos || line.find("reads(int)") != std::string::npos)
+                ++recursive_frames;
+        }
+    }
+
+    EXPECT_EQ(events, 42);
+    EXPECT_EQ(with_stack, 42);
+    // Every recursion depth is a distinct stack, each seen exactly once.
+    EXPECT_EQ(definitions, 42);
+    EXPECT_EQ(recursive_frames, 2 * (21 * 22 / 2));
+}
+
+TEST(GWatchFunctional, Coalescing) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/repeat_test.out test_data/repeat_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    std::string out = run_command_capture_stdout("./gwatch --var watched --coalesce --exec /tmp/repeat_test.out");
+    auto res = getReadsAndWrites(std::string(out));
+    EXPECT_EQ(res.first, 2);
+    EXPECT_EQ(res.second, 1);
+    EXPECT_NE(out.find("read\t\t\t7\t\t\t(x100, "), std::string::npos);
+    EXPECT_NE(out.find("write\t\t\t7 -> 7\t\t\t(x50, "), std::string::npos);
+    EXPECT_NE(out.find("total\t\t\t100 reads, 51 writes, 0 unchanged writes suppressed"), std::string::npos);
+
+    out = run_command_capture_stdout("./gwatch --var watched --suppress-unchanged --exec /tmp/repeat_test.out");
+    res = getReadsAndWrites(std::string(out));
+    EXPECT_EQ(res.first, 1);
+    EXPECT_EQ(res.second, 100);
+    EXPECT_NE(out.find("total\t\t\t100 reads, 51 writes, 50 unchanged writes suppressed"), std::string::npos);
+}
+
+TEST(GWatchFunctional, CoalescingStreams) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/idle_test.out test_data/idle_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    // The tracee sleeps for 2 s after its reads; the run has to show up while it is still asleep.
+    auto start = std::chrono::steady_clock::now();
+    FILE *pipe = popen("./gwatch --var watched --coalesce --exec /tmp/idle_test.out", "r");
+    ASSERT_NE(pipe, nullptr);
+    std::array<char, 256> buf;
+    bool seen = false;
+    while (!seen && fgets(buf.data(), buf.size(), pipe) != nullptr)
+        seen = strstr(buf.data(), "read\t\t\t7\t\t\t(x100, ") != nullptr;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    pclose(pipe);
+
+    EXPECT_TRUE(seen);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1500));
+}
+
+TEST(GWatchFunctional, SlowConsumerDrops) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/stall_test.out test_data/stall_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    for (std::string policy: {"drop-newest", "drop-oldest"}) {
+        std::string cmd = "./gwatch --var watched --buffer 16 --on-full " + policy +
+                          " --exec /tmp/stall_test.out 2>/dev/null | (sleep 1; cat)";
+        std::string out = run_command_capture_stdout(cmd);
+
+        long printed = 0, dropped_inband = 0, dropped_total = -1;
+        std::istringstream iss(out);
+        std::string line;
+        while (std::getline(iss, line)) {
+            if (line.find("\twrite\t") != std::string::npos || line.find("\tread\t") != std::string::npos) {
+                ++printed;
+            } else if (line.find("\tdropped\t") != std::string::npos) {
+                long n = std::stol(line.substr(line.rfind('\t') + 1));
+                if (line.find("total") != std::string::npos)
+                    dropped_total = n;
+                else
+                    dropped_inband += n;
+            }
+        }
+
+        EXPECT_GT(dropped_inband, 0) << policy;
+        EXPECT_EQ(dropped_inband, dropped_total) << policy;
+        EXPECT_EQ(printed + dropped_inband, 50001) << policy;
+    }
+}
+
+TEST(GWatchFunctional, ClosedOutput) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/stall_test.out test_data/stall_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    // The reader leaves after one line; gwatch has to keep tracing and exit with the tracee's status.
+    std::string out = run_command_capture_stdout(
+        "bash -c './gwatch --var watched --exec /tmp/stall_test.out 2>/tmp/closed_output.err | head -1 >/dev/null;"
+        " echo ${PIPESTATUS[0]}'");
+    EXPECT_EQ(out, "0\n");
+
+    std::ifstream err("/tmp/closed_output.err");
+    std::string line;
+    std::getline(err, line);
+    EXPECT_NE(line.find("cannot write output"), std::string::npos);
+}
+
+static std::string control_request(const std::string &path, const std::string &cmd) {
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; ++attempt) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+            usleep(20000);
+        }
+    }
+    if (fd < 0)
+        return "";
+
+    std::string line = cmd + "\n";
+    if (write(fd, line.data(), line.size()) != (ssize_t) line.size()) {
+        close(fd);
+        return "";
+    }
+    shutdown(fd, SHUT_WR);
+
+    std::string result;
+    std::array<char, 512> buf;
+    ssize_t r;
+    while ((r = read(fd, buf.data(), buf.size())) > 0)
+        result.append(buf.data(), r);
+    close(fd);
+    return result;
+}
+
+static long json_events(const std::string &json) {
+    size_t pos = json.find("\"events\":");
+    return pos == std::string::npos ? -1 : std::stol(json.substr(pos + 9));
+}
+
+TEST(GWatchFunctional, ControlSocket) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/control_test.out test_data/control_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    std::string sock = "/tmp/gwatch_control_test.sock";
+    unlink(sock.c_str());
+    std::string cmd = "./gwatch --var watched --control " + sock +
+                      " --exec /tmp/control_test.out > /tmp/control_test.txt &";
+    ASSERT_EQ(system(cmd.c_str()), 0);
+
+    EXPECT_NE(control_request(sock, "metrics json").find("{\"var\":\"watched\""), std::string::npos);
+
+    EXPECT_EQ(control_request(sock, "add other"), "ok\n");
+    EXPECT_EQ(control_request(sock, "add no_such_symbol").rfind("error: ", 0), 0u);
+    usleep(300000);
+    std::string prom = control_request(sock, "metrics");
+    EXPECT_NE(prom.find("gwatch_writes_total{var=\"other\"} "), std::string::npos);
+    EXPECT_EQ(prom.find("gwatch_writes_total{var=\"other\"} 0\n"), std::string::npos);
+
+    // While paused the debug registers are off, so the counters must not move.
+    EXPECT_EQ(control_request(sock, "pause"), "ok\n");
+    usleep(100000);
+    long paused_events = json_events(control_request(sock, "metrics json"));
+    usleep(300000);
+    EXPECT_EQ(json_events(control_request(sock, "metrics json")), paused_events);
+
+    EXPECT_EQ(control_request(sock, "resume"), "ok\n");
+    EXPECT_EQ(control_request(sock, "remove other"), "ok\n");
+
+    EXPECT_EQ(control_request(sock, std::string(10000, 'x')).rfind("error: command longer than", 0), 0u);
+    EXPECT_EQ(control_request(sock, "sample 1"), "ok\n");
+
+    // Watching it again continues the old series instead of starting a second one.
+    EXPECT_EQ(control_request(sock, "add other"), "ok\n");
+    prom = control_request(sock, "metrics");
+    size_t series = 0;
+    for (size_t pos = 0; (pos = prom.find("gwatch_writes_total{var=\"other\"}", pos)) != std::string::npos; ++pos)
+        ++series;
+    EXPECT_EQ(series, 1u);
+    EXPECT_EQ(prom.find("gwatch_writes_total{var=\"other\"} 0\n"), std::string::npos);
+
+    for (int i = 0; i < 200 && access(sock.c_str(), F_OK) == 0; ++i)
+        usleep(50000);
+    EXPECT_NE(access(sock.c_str(), F_OK), 0);
+
+    std::ifstream f("/tmp/control_test.txt");
+    std::stringstream out;
+    out << f.rdbuf();
+    EXPECT_NE(out.str().find("other\t\t\t\twrite\t"), std::string::npos);
+}
+
+TEST(GWatchFunctional, HistoryQueries) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/basic_test.out test_data/basic_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    std::string hist = "/tmp/basic_test.gwh";
+    run_command_capture_stdout("./gwatch --var watched --history " + hist + " --exec /tmp/basic_test.out");
+
+    std::string q = "./gwatch-query " + hist;
+    EXPECT_NE(run_command_capture_stdout(q + " info").find("records\t\t\t\t32\n"), std::string::npos);
+
+    auto res = getReadsAndWrites(run_command_capture_stdout(q + " range +0 +1000"));
+    EXPECT_EQ(res.first, 11);
+    EXPECT_EQ(res.second, 20);
+
+    std::string change = run_command_capture_stdout(q + " last-change 44 45 watched");
+    ASSERT_NE(change.find("write\t\t\t44 -> 45"), std::string::npos);
+    EXPECT_EQ(run_command_capture_stdout(q + " last-change 45 44"), "");
+
+    // The value is 45 from the instant of that write on, and 44 just before it.
+    std::string at = change.substr(0, change.find('\t'));
+    long double t = std::stold(at.substr(1));
+    char before[64];
+    snprintf(before, sizeof(before), "+%.9Lf", t - 1e-9L);
+    EXPECT_EQ(run_command_capture_stdout(q + " at " + at).rfind("watched\t\t\t\t45\t", 0), 0u);
+    EXPECT_EQ(run_command_capture_stdout(q + " at " + before).rfind("watched\t\t\t\t44\t", 0), 0u);
+    EXPECT_EQ(run_command_capture_stdout(q + " at +1000").rfind("watched\t\t\t\t52\t", 0), 0u);
+}
+
+TEST(GWatchFunctional, HistoryManyBlocks) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/stall_test.out test_data/stall_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    std::string hist = "/tmp/stall_test.gwh";
+    run_command_capture_stdout("./gwatch --var watched --history " + hist + " --exec /tmp/stall_test.out");
+
+    std::string q = "./gwatch-query " + hist;
+    std::string info = run_command_capture_stdout(q + " info");
+    EXPECT_NE(info.find("records\t\t\t\t50002\n"), std::string::npos);
+    EXPECT_NE(info.find("blocks\t\t\t\t13\n"), std::string::npos);
+
+    EXPECT_NE(run_command_capture_stdout(q + " last-change 0 1").find("write\t\t\t0 -> 1"), std::string::npos);
+    EXPECT_EQ(run_command_capture_stdout(q + " at +1000").rfind("watched\t\t\t\t1\t", 0), 0u);
+    auto res = getReadsAndWrites(run_command_capture_stdout(q + " range +0 +1000"));
+    EXPECT_EQ(res.first, 1);
+    EXPECT_EQ(res.second, 50000);
+}
+
+TEST(GWatchFunctional, TypedValues) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/typed_test.out test_data/typed_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    EXPECT_NE(run_command_capture_stdout("./gwatch --var small --exec /tmp/typed_test.out").find("write\t\t\t0 -> 65531"),
+              std::string::npos);
+
+    std::string out = run_command_capture_stdout("./gwatch --var small:i16 --var ratio:f32 --exec /tmp/typed_test.out");
+    EXPECT_NE(out.find("small\t\t\t\twrite\t\t\t-5 -> -6"), std::string::npos);
+    EXPECT_NE(out.find("ratio\t\t\t\twrite\t\t\t1.5 -> 3"), std::string::npos);
+
+    out = run_command_capture_stdout("./gwatch --var byte_ --var cursor:ptr --exec /tmp/typed_test.out");
+    EXPECT_NE(out.find("byte_\t\t\t\twrite\t\t\t200 -> 201"), std::string::npos);
+    EXPECT_NE(out.find("cursor\t\t\t\twrite\t\t\t0x0 -> 0x"), std::string::npos);
+
+    // 16 bytes take all four debug registers, and every 8-byte store traps on its own.
+    out = run_command_capture_stdout("./gwatch --var wide --exec /tmp/typed_test.out");
+    EXPECT_NE(out.find("-> 36893488147419103233\n"), std::string::npos);
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var wide --var small --exec /tmp/typed_test.out 2>/dev/null")), 5);
+
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var small:u32 --exec /tmp/typed_test.out 2>/dev/null")), 5);
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var small:bogus --exec /tmp/typed_test.out 2>/dev/null")), 5);
+
+    std::string hist = "/tmp/typed_test.gwh";
+    run_command_capture_stdout("./gwatch --var small:i16 --history " + hist + " --exec /tmp/typed_test.out");
+    EXPECT_NE(run_command_capture_stdout("./gwatch-query " + hist + " last-change -5 -6").find("write\t\t\t-5 -> -6"),
+              std::string::npos);
+}
+
+TEST(GWatchFunctional, PointerChains) { {
+        std::string cmd = "g++ -O0 -g -o /tmp/chain_test.out test_data/chain_test.cpp";
+        assert(system(cmd.c_str()) == 0);
+    }
+
+    std::string out = run_command_capture_stdout("./gwatch --var '*g_state+16:8' --exec /tmp/chain_test.out");
+    auto res = getReadsAndWrites(std::string(out));
+    EXPECT_EQ(res.first, 15);
+    EXPECT_EQ(res.second, 15);
+    // Storing the same pointer again is not a move, and the write after the last move is not seen.
+    EXPECT_NE(out.find("moved\t\t\t0x0 -> 0x"), std::string::npos);
+    EXPECT_NE(out.find("(move 4)\n"), std::string::npos);
+    EXPECT_EQ(out.find("(move 5)"), std::string::npos);
+    EXPECT_NE(out.find(" -> 0x0\t\t\t(move 4)"), std::string::npos);
+    EXPECT_NE(out.find("*g_state+16\t\t\t\tmoved\t\t\t4 times\n"), std::string::npos);
+    EXPECT_EQ(out.find("-> 100"), std::string::npos);
+
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var '*g_state+' --exec /tmp/chain_test.out 2>/dev/null")), 1);
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var '*(g_state+4)' --exec /tmp/chain_test.out 2>/dev/null")), 5);
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var '*(*g_state+4)' --exec /tmp/chain_test.out 2>/dev/null")), 5);
+    EXPECT_EQ(WEXITSTATUS(system("./gwatch --var '*g_state+16:16' --exec /tmp/chain_test.out 2>/dev/null")), 5);
+}
+
 TEST(GWatchFunctional, Arguments) {
     srand(time(NULL));
     std::string cmd = "g++ -O0 -g -o /tmp/args_test.out test_data/args_test.cpp";